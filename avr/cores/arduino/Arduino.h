@@ -135,12 +135,63 @@ void pinMode(uint8_t pin, uint8_t mode);
 void digitalWrite(uint8_t pin, uint8_t val);
 int digitalRead(uint8_t pin);
 int analogRead(uint8_t pin);
+void analogReadResolution(uint8_t bits);
+void analogReadSpeed(unsigned long adcClock);
+// Starts reading an analog pin and returns right away, false if the ADC
+// is busy. analogReadResult() returns -1 until the value is there.
+bool analogReadAsync(uint8_t pin);
+int analogReadResult(void);
+// Reads a list of analog pins round-robin in the background, at
+// sampleRate samples per second in total (using Timer1), or as fast as
+// the ADC goes when 0. See wiring_adc.c.
+bool analogScanStart(const uint8_t *pins, uint8_t count, unsigned long sampleRate);
+void analogScanStop(void);
+uint8_t analogScanAvailable(void);
+// Returns the next sample, or -1 if there is none. Stores the position of
+// its pin in the list in *index, unless index is NULL.
+int analogScanRead(uint8_t *index);
+// Samples lost since analogScanStart(), because the buffer was full
+uint16_t analogScanDropped(void);
 void analogReference(uint8_t mode);
 void analogWrite(uint8_t pin, int val);
+// analogWrite() that caches the lookup of the pin's timer. PWM stays on
+// at 0 and 255.
+void analogWriteFast(uint8_t pin, uint8_t val);
+// Plays buffers of samples on a PWM pin from the timer interrupt, see
+// wiring_play.c
+bool analogPlayStart(uint8_t pin, unsigned long sampleRate);
+void analogPlayStop(void);
+bool analogPlayQueue(const uint8_t *samples, size_t count);
+bool analogPlayReady(void);
+void analogPlayOnUnderrun(void (*callback)(void));
+// 16-bit PWM on the pins of Timer1, 3, 4 and 5 (fast PWM with ICRn as
+// top), see wiring_pwm.c. The value is a fraction of 65536.
+bool analogWrite16(uint8_t pin, uint16_t value);
+unsigned long analogWriteFrequency(uint8_t pin, unsigned long hz);
 
 unsigned long millis(void);
 unsigned long micros(void);
+// millis() and micros() with 64 bits, so they don't wrap around
+uint64_t millis64(void);
+uint64_t micros64(void);
+// Clock cycles since startup, in steps of 64 cycles. For profiling
+// code, wraps around after 2^32 cycles (268 seconds at 16 MHz).
+unsigned long ticks(void);
 void delay(unsigned long ms);
+// How delay() and the main loop wait: IDLE_BUSY keeps running (the
+// default), IDLE_SLEEP sleeps until the next interrupt. timer0 wakes the
+// CPU at least every 1.024 ms (at 16 MHz), so timing stays the same. It
+// only sleeps when no task or coroutine is due before then, and the main
+// loop not while a serial port has unread data, so loop() runs at most
+// once per interrupt only when it has nothing to do.
+#define IDLE_BUSY 0
+#define IDLE_SLEEP 1
+void setIdleMode(uint8_t mode);
+void idle(void);
+// Lets delay() sleep in a deeper mode (from <avr/sleep.h>, such as
+// SLEEP_MODE_PWR_DOWN) for waits of more than about 16 ms, waking up by
+// the watchdog. See wiring_sleep.c. SLEEP_MODE_IDLE turns it off again.
+void setDelaySleepMode(uint8_t mode);
 void delayMicroseconds(unsigned int us);
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
 unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout);
@@ -148,8 +199,93 @@ unsigned long pulseInLong(uint8_t pin, uint8_t state, unsigned long timeout);
 void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder, uint8_t val);
 uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder);
 
+// Users of the timers (0 to 5) that reconfigure them, so that two don't
+// take the same one. The core only tracks its own users: tone(),
+// analogWrite16(), analogPlayStart() and analogScanStart(). Libraries
+// such as Servo can claim their timer with TIMER_OWNER_SERVO.
+#define TIMER_FREE 0
+#define TIMER_OWNER_TONE 1
+#define TIMER_OWNER_SERVO 2
+#define TIMER_OWNER_PWM 3
+#define TIMER_OWNER_PLAY 4
+#define TIMER_OWNER_ADC 5
+#define TIMER_OWNER_USER 6
+bool timerClaim(uint8_t timer, uint8_t owner);
+void timerRelease(uint8_t timer, uint8_t owner);
+uint8_t timerOwner(uint8_t timer);
+
 void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+// attachInterrupt() for a function that takes a pointer, which it is
+// called with. One function can then serve several pins.
+void attachInterruptArg(uint8_t interruptNum, void (*userFunc)(void *), void *arg, int mode);
 void detachInterrupt(uint8_t interruptNum);
+// Turn an external interrupt on and off, without setting the function
+void enableExternalInterrupt(uint8_t interruptNum, int mode);
+void disableExternalInterrupt(uint8_t interruptNum);
+
+// Defines the handler of an external interrupt vector (INT0_vect and so
+// on, see the datasheet) in the sketch, instead of attachInterrupt():
+//
+//   static inline void onEdge() { count++; }
+//   ATTACH_FAST_ISR(INT0_vect, onEdge)
+//   ...
+//   enableExternalInterrupt(digitalPinToInterrupt(2), RISING);
+//
+// The handler is inlined into the interrupt, which then only saves the
+// registers it uses, instead of all the ones a call may change. Sketches
+// that do this can't use attachInterrupt() as well: it brings along
+// handlers for all vectors, and the link fails.
+#define ATTACH_FAST_ISR(vect, handler) ISR(vect) { handler(); }
+
+// Cooperative tasks. A scheduled task runs from yield() (so also while
+// the sketch is in delay()) and after each loop(), once it is due.
+// Delays and intervals are in microseconds, up to 2^31 (35 minutes).
+// An interval of 0 runs the task once. At most SCHEDULER_MAX_TASKS
+// (default 8) tasks can be scheduled. Don't use from interrupts.
+typedef struct SchedulerTask {
+	void (*callback)(void);
+	unsigned long due;       // micros() at which it runs next
+	unsigned long interval;  // 0 for a task that runs once
+	uint8_t slot;            // position in the queue plus one
+} SchedulerTask;
+
+bool scheduleTask(SchedulerTask *task, void (*callback)(void), unsigned long delayMicros, unsigned long intervalMicros);
+void cancelTask(SchedulerTask *task);
+bool taskScheduled(const SchedulerTask *task);
+// Runs the tasks that are due, and serialEventRun()
+void runTasks(void);
+// Microseconds until the next task is due, 0 if one is due now, or
+// 0xffffffff if none is scheduled
+unsigned long tasksIdleMicros(void);
+
+// Coroutines: functions running on their own stack, which take turns
+// with the sketch. They are switched to when the sketch calls yield(),
+// which delay() and other blocking functions do while they wait, and
+// after each loop(). A coroutine switches back the same way and ends
+// when its function returns. The stack needs room for the deepest calls
+// plus interrupt handlers, so at least 128 bytes. Note that malloc()
+// (and so String) fails on a coroutine stack that is below the heap,
+// unless __malloc_heap_end is set.
+typedef struct Coroutine {
+	void (*func)(void);    // NULL once it returned
+	void *sp;              // saved stack pointer while not running
+	uint8_t *stack;
+	size_t stackSize;
+	struct Coroutine *next;
+} Coroutine;
+
+bool startCoroutine(Coroutine *co, void (*func)(void), void *stack, size_t stackSize);
+bool coroutineRunning(const Coroutine *co);
+// The most stack the coroutine used so far, in bytes
+size_t coroutineStackUsed(const Coroutine *co);
+// From the sketch, runs each coroutine until it yields and returns true.
+// From a coroutine, switches back and returns false once resumed.
+bool runCoroutines(void);
+// Microseconds until a coroutine needs to run again: 0 if one can run
+// now (or when called from a coroutine, as the sketch can), the time
+// left of the shortest delay() when all of them wait in delay(), or
+// 0xffffffff if there are none
+unsigned long coroutinesIdleMicros(void);
 
 void setup(void);
 void loop(void);
@@ -230,6 +366,7 @@ extern const uint8_t PROGMEM digital_pin_to_timer_PGM[];
 #ifdef __cplusplus
 #include "WCharacter.h"
 #include "WString.h"
+#include "StaticString.h"
 #include "HardwareSerial.h"
 #include "USBAPI.h"
 #if defined(HAVE_HWSERIAL0) && defined(HAVE_CDCSERIAL)
@@ -256,5 +393,6 @@ long map(long, long, long, long, long);
 #endif
 
 #include "pins_arduino.h"
+#include "FastPin.h"
 
 #endif
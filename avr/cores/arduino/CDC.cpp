@@ -203,6 +203,23 @@ int Serial_::read(void)
 	return USB_Recv(CDC_RX);
 }
 
+int Serial_::read(uint8_t *buffer, size_t size)
+{
+	size_t count = 0;
+	if (size == 0)
+		return 0;
+	if (peek_buffer >= 0) {
+		*buffer++ = peek_buffer;
+		peek_buffer = -1;
+		size--;
+		count++;
+	}
+	int r = USB_Recv(CDC_RX, buffer, size);
+	if (r > 0)
+		count += r;
+	return count;
+}
+
 int Serial_::availableForWrite(void)
 {
 	return USB_SendSpace(CDC_TX);
@@ -0,0 +1,166 @@
+/*
+  FastPin.h - Digital I/O for pins known at compile time
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef FastPin_h
+#define FastPin_h
+
+// When the pin number is a constant, the compiler can look it up in the
+// variant tables (pins_arduino.h) itself, when it sees them with link
+// time optimization. pinMode(), digitalWrite() and digitalRead() then
+// access the port registers directly, instead of calling functions that
+// do the lookups at runtime. Otherwise, and for pins with PWM (which
+// digitalWrite() and digitalRead() turn off), they call those functions.
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+// true if the compiler knows where P is, and it is a pin. The macros
+// after it read the tables as if they were in RAM, so they may only be
+// used when it does: nothing is actually read then.
+#define digitalPinIsConstant(P) (__builtin_constant_p(P) && \
+	__builtin_constant_p(digital_pin_to_port_PGM[P]) && \
+	digital_pin_to_port_PGM[P] != NOT_A_PIN && \
+	__builtin_constant_p(digital_pin_to_bit_mask_PGM[P]) && \
+	__builtin_constant_p(digital_pin_to_timer_PGM[P]) && \
+	__builtin_constant_p(port_to_mode_PGM[digital_pin_to_port_PGM[P]]) && \
+	__builtin_constant_p(port_to_output_PGM[digital_pin_to_port_PGM[P]]) && \
+	__builtin_constant_p(port_to_input_PGM[digital_pin_to_port_PGM[P]]))
+#define constPinToPort(P) (digital_pin_to_port_PGM[P])
+#define constPinToBitMask(P) (digital_pin_to_bit_mask_PGM[P])
+#define constPinToTimer(P) (digital_pin_to_timer_PGM[P])
+#define constPinModeRegister(P) ((volatile uint8_t *)port_to_mode_PGM[constPinToPort(P)])
+#define constPinOutputRegister(P) ((volatile uint8_t *)port_to_output_PGM[constPinToPort(P)])
+#define constPinInputRegister(P) ((volatile uint8_t *)port_to_input_PGM[constPinToPort(P)])
+
+// Sets or clears the bits of a register at a constant address. The lower
+// I/O registers can be changed with sbi/cbi, which can't be interrupted.
+// The others (PORTH and up on the Mega) take a read-modify-write, with
+// interrupts disabled.
+static inline __attribute__((always_inline))
+void constRegisterWrite(volatile uint8_t *reg, uint8_t mask, uint8_t val)
+{
+	if ((uintptr_t)reg < __SFR_OFFSET + 0x20) {
+		if (val) *reg |= mask; else *reg &= ~mask;
+	} else {
+		uint8_t oldSREG = SREG;
+		cli();
+		if (val) *reg |= mask; else *reg &= ~mask;
+		SREG = oldSREG;
+	}
+}
+
+// The calls in these refer to the functions in wiring_digital.c
+extern inline __attribute__((gnu_inline))
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (digitalPinIsConstant(pin) && __builtin_constant_p(mode)) {
+		uint8_t bit = constPinToBitMask(pin);
+		if (mode == INPUT) {
+			constRegisterWrite(constPinModeRegister(pin), bit, 0);
+			constRegisterWrite(constPinOutputRegister(pin), bit, 0);
+		} else if (mode == INPUT_PULLUP) {
+			constRegisterWrite(constPinModeRegister(pin), bit, 0);
+			constRegisterWrite(constPinOutputRegister(pin), bit, 1);
+		} else {
+			constRegisterWrite(constPinModeRegister(pin), bit, 1);
+		}
+	} else {
+		pinMode(pin, mode);
+	}
+}
+
+extern inline __attribute__((gnu_inline))
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	if (digitalPinIsConstant(pin) && constPinToTimer(pin) == NOT_ON_TIMER)
+		constRegisterWrite(constPinOutputRegister(pin), constPinToBitMask(pin), val != LOW);
+	else
+		digitalWrite(pin, val);
+}
+
+extern inline __attribute__((gnu_inline))
+int digitalRead(uint8_t pin)
+{
+	if (digitalPinIsConstant(pin) && constPinToTimer(pin) == NOT_ON_TIMER)
+		return (*constPinInputRegister(pin) & constPinToBitMask(pin)) ? HIGH : LOW;
+	return digitalRead(pin);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+
+// A pin as a type, for bit-banging:
+//
+//   typedef FastPin<13> Led;
+//   Led::output();
+//   Led::high();
+//
+// Unlike digitalWrite() and digitalRead(), this leaves PWM on the pin
+// alone. Without link time optimization, the pin is looked up at
+// runtime.
+template<uint8_t PIN>
+class FastPin
+{
+  public:
+    static void input() { pinMode(PIN, INPUT); }
+    static void inputPullup() { pinMode(PIN, INPUT_PULLUP); }
+    static void output() { pinMode(PIN, OUTPUT); }
+
+    static void high() { write(HIGH); }
+    static void low() { write(LOW); }
+    static void write(uint8_t val) {
+      if (digitalPinIsConstant(PIN)) {
+        constRegisterWrite(constPinOutputRegister(PIN), constPinToBitMask(PIN), val != LOW);
+      } else {
+        uint8_t port = digitalPinToPort(PIN);
+        uint8_t bit = digitalPinToBitMask(PIN);
+        if (port == NOT_A_PIN) return;
+        volatile uint8_t *out = portOutputRegister(port);
+        uint8_t oldSREG = SREG;
+        cli();
+        if (val == LOW) *out &= ~bit; else *out |= bit;
+        SREG = oldSREG;
+      }
+    }
+    // Writing a one to the input register toggles the output, on all
+    // chips but the ATmega8
+    static void toggle() {
+#if !defined(__AVR_ATmega8__)
+      if (digitalPinIsConstant(PIN)) {
+        *constPinInputRegister(PIN) = constPinToBitMask(PIN);
+      } else {
+        uint8_t port = digitalPinToPort(PIN);
+        if (port != NOT_A_PIN)
+          *portInputRegister(port) = digitalPinToBitMask(PIN);
+      }
+#else
+      write(!read());
+#endif
+    }
+    static int read() {
+      if (digitalPinIsConstant(PIN))
+        return (*constPinInputRegister(PIN) & constPinToBitMask(PIN)) ? HIGH : LOW;
+      uint8_t port = digitalPinToPort(PIN);
+      if (port == NOT_A_PIN) return LOW;
+      return (*portInputRegister(port) & digitalPinToBitMask(PIN)) ? HIGH : LOW;
+    }
+};
+
+#endif // __cplusplus
+#endif // FastPin_h
@@ -61,8 +61,33 @@
   bool Serial3_available() __attribute__((weak));
 #endif
 
+volatile bool HardwareSerial::_rx_event = false;
+HardwareSerial *HardwareSerial::_frame_ports = NULL;
+
+bool serialRxPending(void)
+{
+#if defined(HAVE_HWSERIAL0)
+  if (Serial0_available && Serial0_available()) return true;
+#endif
+#if defined(HAVE_HWSERIAL1)
+  if (Serial1_available && Serial1_available()) return true;
+#endif
+#if defined(HAVE_HWSERIAL2)
+  if (Serial2_available && Serial2_available()) return true;
+#endif
+#if defined(HAVE_HWSERIAL3)
+  if (Serial3_available && Serial3_available()) return true;
+#endif
+  return false;
+}
+
 void serialEventRun(void)
 {
+  // Nothing was received since all ports were last found empty
+  if (!HardwareSerial::_rx_event)
+    return;
+  HardwareSerial::_rx_event = false;
+
 #if defined(HAVE_HWSERIAL0)
   if (Serial0_available && serialEvent && Serial0_available()) serialEvent();
 #endif
@@ -75,46 +100,63 @@ void serialEventRun(void)
 #if defined(HAVE_HWSERIAL3)
   if (Serial3_available && serialEvent3 && Serial3_available()) serialEvent3();
 #endif
+
+  // Keep polling while any port still has unread data or an
+  // unfinished frame
+  bool pending = false;
+  for (HardwareSerial *p = HardwareSerial::_frame_ports; p; p = p->_frame_next) {
+    if (p->_frame_callback && p->frameAvailable())
+      p->_frame_callback();
+    if (p->_rx_frames || p->_rx_idle_armed)
+      pending = true;
+  }
+  if (serialRxPending())
+    pending = true;
+  if (pending)
+    HardwareSerial::_rx_event = true;
 }
 
-// macro to guard critical sections when needed for large TX buffer sizes
-#if (SERIAL_TX_BUFFER_SIZE>256)
-#define TX_BUFFER_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
-#else
-#define TX_BUFFER_ATOMIC
-#endif
+// Read a buffer index that is updated from an interrupt handler without
+// disabling interrupts. A 16-bit index is read twice until both reads
+// match, so an interrupt between reading the low and high byte cannot
+// produce a torn value. An 8-bit index is just read once.
+template <typename T>
+static inline T read_irq_index(const volatile T &index)
+{
+  T value;
+  do {
+    value = index;
+  } while (sizeof(T) > 1 && value != index);
+  return value;
+}
+
+// Store a buffer index that is read from an interrupt handler. The AVR
+// cannot store a 16-bit index in one instruction, so the ISR could
+// otherwise see a half-updated value. An 8-bit index is just stored.
+template <typename T>
+static inline void write_irq_index(volatile T &index, T value)
+{
+  if (sizeof(T) > 1) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      index = value;
+    }
+  } else {
+    index = value;
+  }
+}
 
 // Actual interrupt handlers //////////////////////////////////////////////////////////////
 
 void HardwareSerial::_tx_udr_empty_irq(void)
 {
-  // If interrupts are enabled, there must be more data in the output
-  // buffer. Send the next byte
-  unsigned char c = _tx_buffer[_tx_buffer_tail];
-  _tx_buffer_tail = (_tx_buffer_tail + 1) % SERIAL_TX_BUFFER_SIZE;
-
-  *_udr = c;
-
-  // clear the TXC bit -- "can be cleared by writing a one to its bit
-  // location". This makes sure flush() won't return until the bytes
-  // actually got written. Other r/w bits are preserved, and zeroes
-  // written to the rest.
-
-#ifdef MPCM0
-  *_ucsra = ((*_ucsra) & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
-#else
-  *_ucsra = ((*_ucsra) & ((1 << U2X0) | (1 << TXC0)));
-#endif
-
-  if (_tx_buffer_head == _tx_buffer_tail) {
-    // Buffer empty, so disable interrupts
-    cbi(*_ucsrb, UDRIE0);
-  }
+  // Used when polling with interrupts disabled. The UDRE interrupts
+  // themselves use SizedHardwareSerial::_tx_udr_empty_irq().
+  _tx_udr_empty(_tx_buffer, _tx_buffer_mask);
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
 
-void HardwareSerial::begin(unsigned long baud, byte config)
+void HardwareSerial::begin(unsigned long baud, uint16_t config)
 {
   // Try u2x mode first
   uint16_t baud_setting = (F_CPU / 4 / baud - 1) / 2;
@@ -136,12 +178,23 @@ void HardwareSerial::begin(unsigned long baud, byte config)
   *_ubrrl = baud_setting;
 
   _written = false;
+  clearStats();
+  _baud = baud;
+  _update_idle_ticks();
 
   //set the data bits, parity, and stop bits
 #if defined(__AVR_ATmega8__)
   config |= 0x80; // select UCSRC register (shared with UBRRH)
 #endif
-  *_ucsrc = config;
+  *_ucsrc = (uint8_t)config;
+  // The third character size bit lives in UCSRB
+  if (config & 0x100)
+    sbi(*_ucsrb, UCSZ02);
+  else
+    cbi(*_ucsrb, UCSZ02);
+  cbi(*_ucsrb, TXB80);
+  // Writing UCSRA above cleared the multiprocessor mode bit
+  setAddress(_rx_address);
   
   sbi(*_ucsrb, RXEN0);
   sbi(*_ucsrb, TXEN0);
@@ -165,12 +218,13 @@ void HardwareSerial::end()
 
 int HardwareSerial::available(void)
 {
-  return ((unsigned int)(SERIAL_RX_BUFFER_SIZE + _rx_buffer_head - _rx_buffer_tail)) % SERIAL_RX_BUFFER_SIZE;
+  rx_buffer_index_t head = read_irq_index(_rx_buffer_head);
+  return (head - _rx_buffer_tail) & _rx_buffer_mask;
 }
 
 int HardwareSerial::peek(void)
 {
-  if (_rx_buffer_head == _rx_buffer_tail) {
+  if (read_irq_index(_rx_buffer_head) == _rx_buffer_tail) {
     return -1;
   } else {
     return _rx_buffer[_rx_buffer_tail];
@@ -180,26 +234,46 @@ int HardwareSerial::peek(void)
 int HardwareSerial::read(void)
 {
   // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer_head == _rx_buffer_tail) {
+  if (read_irq_index(_rx_buffer_head) == _rx_buffer_tail) {
     return -1;
   } else {
+    // Read the byte before publishing the new tail, so the ISR cannot
+    // overwrite it in the meantime
     unsigned char c = _rx_buffer[_rx_buffer_tail];
-    _rx_buffer_tail = (rx_buffer_index_t)(_rx_buffer_tail + 1) % SERIAL_RX_BUFFER_SIZE;
+    write_irq_index(_rx_buffer_tail, (rx_buffer_index_t)((_rx_buffer_tail + 1) & _rx_buffer_mask));
     return c;
   }
 }
 
+int HardwareSerial::read(uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  rx_buffer_index_t head = read_irq_index(_rx_buffer_head);
+  rx_buffer_index_t tail = _rx_buffer_tail;
+
+  // Copy at most two contiguous runs: up to the end of the buffer, and
+  // after wrapping around, up to head
+  while (count < size && tail != head) {
+    size_t n = (head > tail ? head : (size_t)_rx_buffer_mask + 1) - tail;
+    if (n > size - count)
+      n = size - count;
+    memcpy(buffer + count, &_rx_buffer[tail], n);
+    count += n;
+    tail = (tail + n) & _rx_buffer_mask;
+  }
+
+  // Publish the new tail only after copying, so the ISR cannot
+  // overwrite the bytes in the meantime
+  write_irq_index(_rx_buffer_tail, tail);
+  return count;
+}
+
 int HardwareSerial::availableForWrite(void)
 {
-  tx_buffer_index_t head;
-  tx_buffer_index_t tail;
+  tx_buffer_index_t head = _tx_buffer_head;
+  tx_buffer_index_t tail = read_irq_index(_tx_buffer_tail);
 
-  TX_BUFFER_ATOMIC {
-    head = _tx_buffer_head;
-    tail = _tx_buffer_tail;
-  }
-  if (head >= tail) return SERIAL_TX_BUFFER_SIZE - 1 - head + tail;
-  return tail - head - 1;
+  return (tail - head - 1) & _tx_buffer_mask;
 }
 
 void HardwareSerial::flush()
@@ -211,12 +285,16 @@ void HardwareSerial::flush()
     return;
 
   while (bit_is_set(*_ucsrb, UDRIE0) || bit_is_clear(*_ucsra, TXC0)) {
-    if (bit_is_clear(SREG, SREG_I) && bit_is_set(*_ucsrb, UDRIE0))
+    if (bit_is_clear(SREG, SREG_I)) {
+      if (bit_is_set(*_ucsrb, UDRIE0))
 	// Interrupts are globally disabled, but the DR empty
 	// interrupt should be enabled, so poll the DR empty flag to
 	// prevent deadlock
 	if (bit_is_set(*_ucsra, UDRE0))
 	  _tx_udr_empty_irq();
+    } else {
+      yield();
+    }
   }
   // If we get here, nothing is queued anymore (DRIE is disabled) and
   // the hardware finished tranmission (TXC is set).
@@ -229,7 +307,7 @@ size_t HardwareSerial::write(uint8_t c)
   // to the data register and be done. This shortcut helps
   // significantly improve the effective datarate at high (>
   // 500kbit/s) bitrates, where interrupt overhead becomes a slowdown.
-  if (_tx_buffer_head == _tx_buffer_tail && bit_is_set(*_ucsra, UDRE0)) {
+  if (_tx_buffer_head == read_irq_index(_tx_buffer_tail) && !_tx_async_busy && bit_is_set(*_ucsra, UDRE0)) {
     // If TXC is cleared before writing UDR and the previous byte
     // completes before writing to UDR, TXC will be set but a byte
     // is still being transmitted causing flush() to return too soon.
@@ -248,11 +326,12 @@ size_t HardwareSerial::write(uint8_t c)
     }
     return 1;
   }
-  tx_buffer_index_t i = (_tx_buffer_head + 1) % SERIAL_TX_BUFFER_SIZE;
+  tx_buffer_index_t i;
 	
   // If the output buffer is full, there's nothing for it other than to 
-  // wait for the interrupt handler to empty it a bit
-  while (i == _tx_buffer_tail) {
+  // wait for the interrupt handler to empty it a bit. The head is read
+  // again each time, since whatever runs from yield() may write too.
+  while ((i = (_tx_buffer_head + 1) & _tx_buffer_mask) == read_irq_index(_tx_buffer_tail)) {
     if (bit_is_clear(SREG, SREG_I)) {
       // Interrupts are disabled, so we'll have to poll the data
       // register empty flag ourselves. If it is set, pretend an
@@ -261,7 +340,8 @@ size_t HardwareSerial::write(uint8_t c)
       if(bit_is_set(*_ucsra, UDRE0))
 	_tx_udr_empty_irq();
     } else {
-      // nop, the interrupt handler will free up space for us
+      // the interrupt handler will free up space for us
+      yield();
     }
   }
 
@@ -278,4 +358,201 @@ size_t HardwareSerial::write(uint8_t c)
   return 1;
 }
 
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = size;
+
+  if (size == 0)
+    return 0;
+
+  _written = true;
+  while (size) {
+    tx_buffer_index_t head = _tx_buffer_head;
+    tx_buffer_index_t tail = read_irq_index(_tx_buffer_tail);
+
+    // Find the contiguous free space starting at head. One slot must
+    // always stay empty, so a full buffer can be told apart from an
+    // empty one.
+    size_t room;
+    if (head >= tail) {
+      room = (size_t)_tx_buffer_mask + 1 - head;
+      if (tail == 0)
+        room--;
+    } else {
+      room = tail - head - 1;
+    }
+
+    if (room == 0) {
+      // The output buffer is full, wait for the interrupt handler to
+      // empty it a bit (or poll it ourselves, see write(uint8_t)).
+      if (bit_is_clear(SREG, SREG_I)) {
+        if (bit_is_set(*_ucsra, UDRE0))
+          _tx_udr_empty_irq();
+      } else {
+        yield();
+      }
+      continue;
+    }
+
+    if (room > size)
+      room = size;
+
+    memcpy(&_tx_buffer[head], buffer, room);
+    buffer += room;
+    size -= room;
+    head = (head + room) & _tx_buffer_mask;
+
+    // Publish the whole run at once. Same as in write(uint8_t), this
+    // must be atomic so the ISR cannot empty the buffer and disable
+    // itself between setting the head and setting the interrupt flag.
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      _tx_buffer_head = head;
+      sbi(*_ucsrb, UDRIE0);
+    }
+  }
+
+  return n;
+}
+
+void HardwareSerial::setFrameIdleBits(uint16_t bits)
+{
+  _rx_idle_bits = bits;
+  _update_idle_ticks();
+}
+
+void HardwareSerial::setFrameDelimiter(int delimiter)
+{
+  // The RX ISR reads both bytes
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _rx_delimiter = delimiter;
+  }
+}
+
+void HardwareSerial::_update_idle_ticks(void)
+{
+  unsigned long ticks = 0;
+  if (_rx_idle_bits && _baud) {
+    // Split at whole milliseconds so the products fit in 32 bits, and
+    // count in half ticks so 20 MHz is exact as well
+    unsigned long ms = (unsigned long)_rx_idle_bits * 1000 / _baud;
+    unsigned long rem = (unsigned long)_rx_idle_bits * 1000 % _baud;
+    unsigned long half = ms * (F_CPU / 32000) + (rem * (F_CPU / 32000) + _baud - 1) / _baud;
+    // Round up, and add one since the timestamp of the last byte can
+    // be up to a tick old already
+    ticks = (half + 1) / 2 + 1;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _rx_idle_ticks = ticks;
+    _rx_idle_armed = false;
+  }
+}
+
+bool HardwareSerial::frameAvailable(void)
+{
+  bool frame = false;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (_rx_frames) {
+      _rx_frames--;
+      frame = true;
+    } else if (_rx_idle_armed &&
+               rx_timestamp() - _rx_last_tick >= _rx_idle_ticks) {
+      _rx_idle_armed = false;
+      frame = true;
+    }
+  }
+  return frame;
+}
+
+void HardwareSerial::onFrame(void (*callback)(void))
+{
+  if (callback && !_frame_callback) {
+    // Add to the list of ports checked by serialEventRun(), unless
+    // already in there
+    HardwareSerial *p = _frame_ports;
+    while (p && p != this)
+      p = p->_frame_next;
+    if (!p) {
+      _frame_next = _frame_ports;
+      _frame_ports = this;
+    }
+  }
+  _frame_callback = callback;
+  _rx_event = true;
+}
+
+void HardwareSerial::setAddress(int address)
+{
+  // Only the U2X bit is kept. TXC is written as zero, which leaves it
+  // unchanged.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _rx_address = address;
+    if (address >= 0)
+      *_ucsra = ((*_ucsra) & (1 << U2X0)) | (1 << MPCM0);
+    else
+      *_ucsra = (*_ucsra) & (1 << U2X0);
+  }
+}
+
+size_t HardwareSerial::writeAddress(uint8_t address)
+{
+  // The ninth bit is a setting in UCSRB, not part of the buffered data,
+  // so everything queued before must be sent first
+  flush();
+
+  _written = true;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    sbi(*_ucsrb, TXB80);
+    *_udr = address;
+    *_ucsra = ((*_ucsra) & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+  }
+
+  // TXB8 is copied into the shift register together with UDR, so it
+  // can be cleared for the data bytes once UDR is empty again
+  while (bit_is_clear(*_ucsra, UDRE0)) {
+    if (bit_is_set(SREG, SREG_I))
+      yield();
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    cbi(*_ucsrb, TXB80);
+  }
+  return 1;
+}
+
+HardwareSerialStats HardwareSerial::stats(void)
+{
+  HardwareSerialStats s;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    s = _rx_stats;
+  }
+  return s;
+}
+
+void HardwareSerial::clearStats(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(&_rx_stats, 0, sizeof(_rx_stats));
+  }
+}
+
+bool HardwareSerial::writeAsync(const uint8_t *buffer, size_t size, void (*callback)(void))
+{
+  if (_tx_async_busy || size == 0)
+    return false;
+
+  _written = true;
+  _tx_async_ptr = buffer;
+  _tx_async_len = size;
+  _tx_async_callback = callback;
+
+  // Everything currently in the TX buffer goes out first, so start
+  // sending this buffer once the tail reaches the current head.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    _tx_async_mark = _tx_buffer_head;
+    _tx_async_busy = true;
+    sbi(*_ucsrb, UDRIE0);
+  }
+
+  return true;
+}
+
 #endif // whole file
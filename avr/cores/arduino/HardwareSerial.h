@@ -32,13 +32,16 @@
 // using a ring buffer (I think), in which head is the index of the location
 // to which to write the next incoming character and tail is the index of the
 // location from which to read.
-// NOTE: a "power of 2" buffer size is reccomended to dramatically
-//       optimize all the modulo operations for ring buffers.
-// WARNING: When buffer sizes are increased to > 256, the buffer index
-// variables are automatically increased in size, but the extra
-// atomicity guards needed for that are not implemented. This will
-// often work, but occasionally a race condition can occur that makes
-// Serial behave erratically. See https://github.com/arduino/Arduino/issues/2405
+// NOTE: buffer sizes must be a power of 2, so the ring buffer indices
+//       can wrap using a simple mask.
+// The sizes below apply to all ports, but can be overridden per port
+// using SERIALn_RX_BUFFER_SIZE and SERIALn_TX_BUFFER_SIZE (n = 0..3).
+// When buffer sizes are increased to > 256, the buffer index variables
+// are automatically increased in size. Each index is only written by
+// one side (the ISR or the main code), and the main code re-reads
+// indices owned by the ISR until it gets a consistent value, so this
+// is safe without disabling interrupts around reads.
+// See https://github.com/arduino/Arduino/issues/2405
 #if !defined(SERIAL_TX_BUFFER_SIZE)
 #if ((RAMEND - RAMSTART) < 1023)
 #define SERIAL_TX_BUFFER_SIZE 16
@@ -53,12 +56,38 @@
 #define SERIAL_RX_BUFFER_SIZE 64
 #endif
 #endif
-#if (SERIAL_TX_BUFFER_SIZE>256)
+#if !defined(SERIAL0_TX_BUFFER_SIZE)
+#define SERIAL0_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL0_RX_BUFFER_SIZE)
+#define SERIAL0_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL1_TX_BUFFER_SIZE)
+#define SERIAL1_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL1_RX_BUFFER_SIZE)
+#define SERIAL1_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL2_TX_BUFFER_SIZE)
+#define SERIAL2_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL2_RX_BUFFER_SIZE)
+#define SERIAL2_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL3_TX_BUFFER_SIZE)
+#define SERIAL3_TX_BUFFER_SIZE SERIAL_TX_BUFFER_SIZE
+#endif
+#if !defined(SERIAL3_RX_BUFFER_SIZE)
+#define SERIAL3_RX_BUFFER_SIZE SERIAL_RX_BUFFER_SIZE
+#endif
+#if (SERIAL0_TX_BUFFER_SIZE>256) || (SERIAL1_TX_BUFFER_SIZE>256) || \
+    (SERIAL2_TX_BUFFER_SIZE>256) || (SERIAL3_TX_BUFFER_SIZE>256)
 typedef uint16_t tx_buffer_index_t;
 #else
 typedef uint8_t tx_buffer_index_t;
 #endif
-#if  (SERIAL_RX_BUFFER_SIZE>256)
+#if (SERIAL0_RX_BUFFER_SIZE>256) || (SERIAL1_RX_BUFFER_SIZE>256) || \
+    (SERIAL2_RX_BUFFER_SIZE>256) || (SERIAL3_RX_BUFFER_SIZE>256)
 typedef uint16_t rx_buffer_index_t;
 #else
 typedef uint8_t rx_buffer_index_t;
@@ -89,6 +118,23 @@ typedef uint8_t rx_buffer_index_t;
 #define SERIAL_6O2 0x3A
 #define SERIAL_7O2 0x3C
 #define SERIAL_8O2 0x3E
+// 9 data bits, for the multiprocessor mode (see setAddress())
+#define SERIAL_9N1 0x106
+#define SERIAL_9N2 0x10E
+#define SERIAL_9E1 0x126
+#define SERIAL_9E2 0x12E
+#define SERIAL_9O1 0x136
+#define SERIAL_9O2 0x13E
+
+// Receive error counters, see HardwareSerial::stats()
+struct HardwareSerialStats
+{
+  uint16_t rx_overflow;  // bytes dropped because the RX buffer was full
+  uint16_t rx_overrun;   // data overruns (DOR), bytes lost by the hardware
+  uint16_t rx_framing;   // bytes received with a framing error (FE)
+  uint16_t rx_parity;    // bytes dropped because of a parity error (UPE)
+  rx_buffer_index_t rx_high_water; // most bytes ever waiting in the RX buffer
+};
 
 class HardwareSerial : public Stream
 {
@@ -107,55 +153,169 @@ class HardwareSerial : public Stream
     volatile tx_buffer_index_t _tx_buffer_head;
     volatile tx_buffer_index_t _tx_buffer_tail;
 
-    // Don't put any members after these buffers, since only the first
-    // 32 bytes of this struct can be accessed quickly using the ldd
-    // instruction.
-    unsigned char _rx_buffer[SERIAL_RX_BUFFER_SIZE];
-    unsigned char _tx_buffer[SERIAL_TX_BUFFER_SIZE];
+    // Caller-owned buffer queued by writeAsync(). It is sent once the
+    // ring buffer tail reaches _tx_async_mark, so bytes written before
+    // and after it keep their order.
+    volatile bool _tx_async_busy;
+    tx_buffer_index_t _tx_async_mark;
+    const uint8_t *_tx_async_ptr;
+    size_t _tx_async_len;
+    void (*_tx_async_callback)(void);
+
+    // Updated by the RX ISR only
+    HardwareSerialStats _rx_stats;
+
+    // Address to filter on in multiprocessor mode, -1 when disabled
+    int16_t _rx_address;
+
+    // Frame detection, see setFrameDelimiter() and setFrameIdleBits()
+    int16_t _rx_delimiter;
+    volatile uint8_t _rx_frames;        // delimiters not yet reported, at most 255
+    volatile bool _rx_idle_armed;       // bytes received since last frame
+    volatile unsigned long _rx_last_tick;  // timer0 ticks at last byte
+    unsigned long _rx_idle_ticks;
+    uint16_t _rx_idle_bits;
+    unsigned long _baud;
+    void (*_frame_callback)(void);
+    HardwareSerial *_frame_next;
+
+    // Set by the RX ISRs, so serialEventRun() only polls the ports when
+    // something was received since it last found them all empty.
+    static volatile bool _rx_event;
+    // Ports that have a callback set with onFrame()
+    static HardwareSerial *_frame_ports;
+    friend void serialEventRun(void);
+    void _update_idle_ticks(void);
+
+    // The buffers themselves live in SizedHardwareSerial. Their sizes
+    // are powers of 2, so indices wrap by and-ing with these masks.
+    unsigned char * const _rx_buffer;
+    unsigned char * const _tx_buffer;
+    const rx_buffer_index_t _rx_buffer_mask;
+    const tx_buffer_index_t _tx_buffer_mask;
+
+    // Interrupt handler bodies, shared by all ports. The buffer and mask
+    // are passed in, so SizedHardwareSerial can pass constants.
+    inline void _rx_complete(unsigned char *buffer, rx_buffer_index_t mask);
+    inline void _tx_udr_empty(unsigned char *buffer, tx_buffer_index_t mask);
 
   public:
     inline HardwareSerial(
       volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
       volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
-      volatile uint8_t *ucsrc, volatile uint8_t *udr);
+      volatile uint8_t *ucsrc, volatile uint8_t *udr,
+      unsigned char *rx_buffer, rx_buffer_index_t rx_mask,
+      unsigned char *tx_buffer, tx_buffer_index_t tx_mask);
     void begin(unsigned long baud) { begin(baud, SERIAL_8N1); }
-    void begin(unsigned long, uint8_t);
+    void begin(unsigned long, uint16_t);
     void end();
     virtual int available(void);
     virtual int peek(void);
     virtual int read(void);
+    virtual int read(uint8_t *buffer, size_t size);
     virtual int availableForWrite(void);
     virtual void flush(void);
     virtual size_t write(uint8_t);
+    virtual size_t write(const uint8_t *buffer, size_t size);
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
     inline size_t write(unsigned int n) { return write((uint8_t)n); }
     inline size_t write(int n) { return write((uint8_t)n); }
-    using Print::write; // pull in write(str) and write(buf, size) from Print
+    using Print::write; // pull in write(str) and write(char*, size) from Print
+    // Send buffer straight from the caller's memory, without copying it
+    // into the TX buffer. The buffer must stay valid until callback
+    // (which runs from interrupt context, may be NULL) has been called.
+    // Returns false, without calling callback, if size is 0 or a
+    // previous writeAsync() is still in progress.
+    bool writeAsync(const uint8_t *buffer, size_t size, void (*callback)(void) = NULL);
+    bool writeAsyncPending(void) { return _tx_async_busy; }
+    // Multiprocessor communication mode, used with the SERIAL_9xx
+    // configs. With an address set, the hardware ignores all data bytes
+    // until an address byte (ninth bit set) matching it is received,
+    // and again after the next address byte for another node. -1
+    // disables filtering. writeAddress() sends an address byte, after
+    // waiting for all queued data to be sent.
+    void setAddress(int address);
+    size_t writeAddress(uint8_t address);
+    // Report complete frames instead of polling available(). A frame
+    // ends when the delimiter byte is received (-1 disables) or when
+    // the line has been idle for the given number of bit times after
+    // the last byte (0 disables). Idle time is measured in timer0 ticks
+    // (4 us at 16 MHz), and rounded up to them. More than 255 delimiters
+    // that are not reported yet count as 255.
+    void setFrameDelimiter(int delimiter);
+    void setFrameIdleBits(uint16_t bits);
+    // Returns true once for every frame that was completed
+    bool frameAvailable(void);
+    // Call callback from serialEventRun() (after loop()) for every
+    // completed frame. NULL removes the callback.
+    void onFrame(void (*callback)(void));
+    // Receive error counters since begin() or clearStats(). The counters
+    // wrap around at 65535.
+    HardwareSerialStats stats(void);
+    void clearStats(void);
     operator bool() { return true; }
 
     // Interrupt handlers - Not intended to be called externally
-    inline void _rx_complete_irq(void);
     void _tx_udr_empty_irq(void);
 };
 
+// A HardwareSerial that holds its own RX and TX buffers. Since the
+// sizes are template arguments, the interrupt handlers of each port get
+// the buffer addresses and masks as constants.
+template <size_t RX_SIZE, size_t TX_SIZE>
+class SizedHardwareSerial : public HardwareSerial
+{
+    static_assert(RX_SIZE >= 2 && (RX_SIZE & (RX_SIZE - 1)) == 0,
+                  "Serial RX buffer size must be a power of 2");
+    static_assert(TX_SIZE >= 2 && (TX_SIZE & (TX_SIZE - 1)) == 0,
+                  "Serial TX buffer size must be a power of 2");
+    static_assert((rx_buffer_index_t)(RX_SIZE - 1) == RX_SIZE - 1,
+                  "Serial RX buffer size too big for rx_buffer_index_t");
+    static_assert((tx_buffer_index_t)(TX_SIZE - 1) == TX_SIZE - 1,
+                  "Serial TX buffer size too big for tx_buffer_index_t");
+
+  protected:
+    // Don't put any members after these buffers, since only the first
+    // 32 bytes of this struct can be accessed quickly using the ldd
+    // instruction.
+    unsigned char _rx_storage[RX_SIZE];
+    unsigned char _tx_storage[TX_SIZE];
+
+  public:
+    inline SizedHardwareSerial(
+      volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
+      volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
+      volatile uint8_t *ucsrc, volatile uint8_t *udr) :
+        HardwareSerial(ubrrh, ubrrl, ucsra, ucsrb, ucsrc, udr,
+                       _rx_storage, RX_SIZE - 1, _tx_storage, TX_SIZE - 1)
+    {
+    }
+
+    // Interrupt handlers - Not intended to be called externally
+    inline void _rx_complete_irq(void) { _rx_complete(_rx_storage, RX_SIZE - 1); }
+    inline void _tx_udr_empty_irq(void) { _tx_udr_empty(_tx_storage, TX_SIZE - 1); }
+};
+
 #if defined(UBRRH) || defined(UBRR0H)
-  extern HardwareSerial Serial;
+  extern SizedHardwareSerial<SERIAL0_RX_BUFFER_SIZE, SERIAL0_TX_BUFFER_SIZE> Serial;
   #define HAVE_HWSERIAL0
 #endif
 #if defined(UBRR1H)
-  extern HardwareSerial Serial1;
+  extern SizedHardwareSerial<SERIAL1_RX_BUFFER_SIZE, SERIAL1_TX_BUFFER_SIZE> Serial1;
   #define HAVE_HWSERIAL1
 #endif
 #if defined(UBRR2H)
-  extern HardwareSerial Serial2;
+  extern SizedHardwareSerial<SERIAL2_RX_BUFFER_SIZE, SERIAL2_TX_BUFFER_SIZE> Serial2;
   #define HAVE_HWSERIAL2
 #endif
 #if defined(UBRR3H)
-  extern HardwareSerial Serial3;
+  extern SizedHardwareSerial<SERIAL3_RX_BUFFER_SIZE, SERIAL3_TX_BUFFER_SIZE> Serial3;
   #define HAVE_HWSERIAL3
 #endif
 
 extern void serialEventRun(void) __attribute__((weak));
+// true if any of the ports has received data that is not read yet
+extern bool serialRxPending(void) __attribute__((weak));
 
 #endif
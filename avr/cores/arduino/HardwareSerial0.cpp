@@ -65,9 +65,9 @@ ISR(USART_UDRE_vect)
 }
 
 #if defined(UBRRH) && defined(UBRRL)
-  HardwareSerial Serial(&UBRRH, &UBRRL, &UCSRA, &UCSRB, &UCSRC, &UDR);
+  SizedHardwareSerial<SERIAL0_RX_BUFFER_SIZE, SERIAL0_TX_BUFFER_SIZE> Serial(&UBRRH, &UBRRL, &UCSRA, &UCSRB, &UCSRC, &UDR);
 #else
-  HardwareSerial Serial(&UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UCSR0C, &UDR0);
+  SizedHardwareSerial<SERIAL0_RX_BUFFER_SIZE, SERIAL0_TX_BUFFER_SIZE> Serial(&UBRR0H, &UBRR0L, &UCSR0A, &UCSR0B, &UCSR0C, &UDR0);
 #endif
 
 // Function that can be weakly referenced by serialEventRun to prevent
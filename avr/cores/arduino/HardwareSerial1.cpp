@@ -58,7 +58,7 @@ ISR(USART1_UDRE_vect)
   Serial1._tx_udr_empty_irq();
 }
 
-HardwareSerial Serial1(&UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UCSR1C, &UDR1);
+SizedHardwareSerial<SERIAL1_RX_BUFFER_SIZE, SERIAL1_TX_BUFFER_SIZE> Serial1(&UBRR1H, &UBRR1L, &UCSR1A, &UCSR1B, &UCSR1C, &UDR1);
 
 // Function that can be weakly referenced by serialEventRun to prevent
 // pulling in this file if it's not otherwise used.
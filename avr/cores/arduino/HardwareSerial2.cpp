@@ -46,7 +46,7 @@ ISR(USART2_UDRE_vect)
   Serial2._tx_udr_empty_irq();
 }
 
-HardwareSerial Serial2(&UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UCSR2C, &UDR2);
+SizedHardwareSerial<SERIAL2_RX_BUFFER_SIZE, SERIAL2_TX_BUFFER_SIZE> Serial2(&UBRR2H, &UBRR2L, &UCSR2A, &UCSR2B, &UCSR2C, &UDR2);
 
 // Function that can be weakly referenced by serialEventRun to prevent
 // pulling in this file if it's not otherwise used.
@@ -46,7 +46,7 @@ ISR(USART3_UDRE_vect)
   Serial3._tx_udr_empty_irq();
 }
 
-HardwareSerial Serial3(&UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UCSR3C, &UDR3);
+SizedHardwareSerial<SERIAL3_RX_BUFFER_SIZE, SERIAL3_TX_BUFFER_SIZE> Serial3(&UBRR3H, &UBRR3L, &UCSR3A, &UCSR3B, &UCSR3C, &UDR3);
 
 // Function that can be weakly referenced by serialEventRun to prevent
 // pulling in this file if it's not otherwise used.
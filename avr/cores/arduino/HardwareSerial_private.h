@@ -48,6 +48,12 @@
 #define U2X0 U2X
 #define UPE0 UPE
 #define UDRE0 UDRE
+#define DOR0 DOR
+#define FE0 FE
+#define MPCM0 MPCM
+#define UCSZ02 UCSZ2
+#define RXB80 RXB8
+#define TXB80 TXB8
 #elif defined(TXC1)
 // Some devices have uart1 but no uart0
 #define TXC0 TXC1
@@ -58,6 +64,12 @@
 #define U2X0 U2X1
 #define UPE0 UPE1
 #define UDRE0 UDRE1
+#define DOR0 DOR1
+#define FE0 FE1
+#define MPCM0 MPCM1
+#define UCSZ02 UCSZ12
+#define RXB80 RXB81
+#define TXB80 TXB81
 #else
 #error No UART found in HardwareSerial.cpp
 #endif
@@ -68,56 +80,171 @@
 // changed for future hardware.
 #if defined(TXC1) && (TXC1 != TXC0 || RXEN1 != RXEN0 || RXCIE1 != RXCIE0 || \
 		      UDRIE1 != UDRIE0 || U2X1 != U2X0 || UPE1 != UPE0 || \
-		      UDRE1 != UDRE0)
+		      UDRE1 != UDRE0 || DOR1 != DOR0 || FE1 != FE0 || \
+		      MPCM1 != MPCM0 || UCSZ12 != UCSZ02 || RXB81 != RXB80 || \
+		      TXB81 != TXB80)
 #error "Not all bit positions for UART1 are the same as for UART0"
 #endif
 #if defined(TXC2) && (TXC2 != TXC0 || RXEN2 != RXEN0 || RXCIE2 != RXCIE0 || \
 		      UDRIE2 != UDRIE0 || U2X2 != U2X0 || UPE2 != UPE0 || \
-		      UDRE2 != UDRE0)
+		      UDRE2 != UDRE0 || DOR2 != DOR0 || FE2 != FE0 || \
+		      MPCM2 != MPCM0 || UCSZ22 != UCSZ02 || RXB82 != RXB80 || \
+		      TXB82 != TXB80)
 #error "Not all bit positions for UART2 are the same as for UART0"
 #endif
 #if defined(TXC3) && (TXC3 != TXC0 || RXEN3 != RXEN0 || RXCIE3 != RXCIE0 || \
 		      UDRIE3 != UDRIE0 || U3X3 != U3X0 || UPE3 != UPE0 || \
-		      UDRE3 != UDRE0)
+		      UDRE3 != UDRE0 || DOR3 != DOR0 || FE3 != FE0 || \
+		      MPCM3 != MPCM0 || UCSZ32 != UCSZ02 || RXB83 != RXB80 || \
+		      TXB83 != TXB80)
 #error "Not all bit positions for UART3 are the same as for UART0"
 #endif
 
+// Maintained by the timer0 overflow ISR in wiring.c
+extern "C" volatile unsigned long timer0_overflow_count;
+
+// The time in timer0 ticks (64 clock cycles, 4 us at 16 MHz), for
+// measuring idle time between frames. Only called with interrupts off,
+// so an overflow that is pending has not been counted yet.
+static inline unsigned long rx_timestamp(void)
+{
+  unsigned long m = timer0_overflow_count;
+  uint8_t t = TCNT0;
+#if defined(TIFR0)
+  if (bit_is_set(TIFR0, TOV0) && t != 255)
+#else
+  if (bit_is_set(TIFR, TOV0) && t != 255)
+#endif
+    m++;
+  return (m << 8) | t;
+}
+
 // Constructors ////////////////////////////////////////////////////////////////
 
 HardwareSerial::HardwareSerial(
   volatile uint8_t *ubrrh, volatile uint8_t *ubrrl,
   volatile uint8_t *ucsra, volatile uint8_t *ucsrb,
-  volatile uint8_t *ucsrc, volatile uint8_t *udr) :
+  volatile uint8_t *ucsrc, volatile uint8_t *udr,
+  unsigned char *rx_buffer, rx_buffer_index_t rx_mask,
+  unsigned char *tx_buffer, tx_buffer_index_t tx_mask) :
     _ubrrh(ubrrh), _ubrrl(ubrrl),
     _ucsra(ucsra), _ucsrb(ucsrb), _ucsrc(ucsrc),
     _udr(udr),
     _rx_buffer_head(0), _rx_buffer_tail(0),
-    _tx_buffer_head(0), _tx_buffer_tail(0)
+    _tx_buffer_head(0), _tx_buffer_tail(0),
+    _tx_async_busy(false),
+    _rx_stats(),
+    _rx_address(-1),
+    _rx_delimiter(-1), _rx_frames(0), _rx_idle_armed(false),
+    _rx_idle_ticks(0), _rx_idle_bits(0), _baud(0),
+    _frame_callback(NULL), _frame_next(NULL),
+    _rx_buffer(rx_buffer), _tx_buffer(tx_buffer),
+    _rx_buffer_mask(rx_mask), _tx_buffer_mask(tx_mask)
 {
 }
 
 // Actual interrupt handlers //////////////////////////////////////////////////////////////
 
-void HardwareSerial::_rx_complete_irq(void)
+void HardwareSerial::_rx_complete(unsigned char *buffer, rx_buffer_index_t mask)
 {
-  if (bit_is_clear(*_ucsra, UPE0)) {
+  // The error flags belong to the byte in UDR, so read them first
+  uint8_t status = *_ucsra;
+  if (status & (1 << DOR0))
+    _rx_stats.rx_overrun++;
+  if (status & (1 << FE0))
+    _rx_stats.rx_framing++;
+
+  if (!(status & (1 << UPE0))) {
+    // In multiprocessor mode, a ninth bit of 1 marks an address byte.
+    // RXB8 must be read before UDR.
+    if (_rx_address >= 0 && (*_ucsrb & (1 << RXB80))) {
+      // Receive the data bytes that follow only if they are addressed
+      // to us, otherwise have the hardware ignore them until the next
+      // address byte. Address bytes are not stored. TXC is written as
+      // zero, which leaves it unchanged.
+      if (*_udr == _rx_address)
+        *_ucsra = (*_ucsra) & (1 << U2X0);
+      else
+        *_ucsra = ((*_ucsra) & (1 << U2X0)) | (1 << MPCM0);
+      return;
+    }
+
     // No Parity error, read byte and store it in the buffer if there is
     // room
     unsigned char c = *_udr;
-    rx_buffer_index_t i = (unsigned int)(_rx_buffer_head + 1) % SERIAL_RX_BUFFER_SIZE;
+    rx_buffer_index_t i = (unsigned int)(_rx_buffer_head + 1) & mask;
+    rx_buffer_index_t tail = _rx_buffer_tail;
 
     // if we should be storing the received character into the location
     // just before the tail (meaning that the head would advance to the
     // current location of the tail), we're about to overflow the buffer
     // and so we don't write the character or advance the head.
-    if (i != _rx_buffer_tail) {
-      _rx_buffer[_rx_buffer_head] = c;
+    if (i != tail) {
+      buffer[_rx_buffer_head] = c;
       _rx_buffer_head = i;
+      _rx_event = true;
+
+      if (c == _rx_delimiter) {
+        // Stays at 255 rather than wrap to no frames at all
+        if (_rx_frames != 255)
+          _rx_frames++;
+        _rx_idle_armed = false;
+      } else if (_rx_idle_ticks) {
+        _rx_last_tick = rx_timestamp();
+        _rx_idle_armed = true;
+      }
+
+      rx_buffer_index_t used = (i - tail) & mask;
+      if (used > _rx_stats.rx_high_water)
+        _rx_stats.rx_high_water = used;
+    } else {
+      _rx_stats.rx_overflow++;
     }
   } else {
     // Parity error, read byte but discard it
     *_udr;
+    _rx_stats.rx_parity++;
   };
 }
 
+void HardwareSerial::_tx_udr_empty(unsigned char *buffer, tx_buffer_index_t mask)
+{
+  // If interrupts are enabled, there must be more data in the output
+  // buffer or a pending writeAsync() buffer. Send the next byte
+  unsigned char c;
+  void (*callback)(void) = NULL;
+  if (_tx_async_busy && _tx_buffer_tail == _tx_async_mark) {
+    c = *_tx_async_ptr++;
+    if (--_tx_async_len == 0) {
+      callback = _tx_async_callback;
+      _tx_async_busy = false;
+    }
+  } else {
+    c = buffer[_tx_buffer_tail];
+    _tx_buffer_tail = (_tx_buffer_tail + 1) & mask;
+  }
+
+  *_udr = c;
+
+  // clear the TXC bit -- "can be cleared by writing a one to its bit
+  // location". This makes sure flush() won't return until the bytes
+  // actually got written. Other r/w bits are preserved, and zeroes
+  // written to the rest.
+
+#ifdef MPCM0
+  *_ucsra = ((*_ucsra) & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);
+#else
+  *_ucsra = ((*_ucsra) & ((1 << U2X0) | (1 << TXC0)));
+#endif
+
+  if (_tx_buffer_head == _tx_buffer_tail && !_tx_async_busy) {
+    // Buffer empty, so disable interrupts
+    cbi(*_ucsrb, UDRIE0);
+  }
+
+  // Called last, so the callback can already queue the next buffer
+  if (callback)
+    callback();
+}
+
 #endif // whole file
@@ -198,69 +198,436 @@ size_t Print::println(const Printable& x)
   return n;
 }
 
+size_t Print::printf(const char *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  size_t n = printFormat(format, false, ap);
+  va_end(ap);
+  return n;
+}
+
+size_t Print::printf(const __FlashStringHelper *format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  size_t n = printFormat(reinterpret_cast<PGM_P>(format), true, ap);
+  va_end(ap);
+  return n;
+}
+
+size_t Print::printf_P(PGM_P format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  size_t n = printFormat(format, true, ap);
+  va_end(ap);
+  return n;
+}
+
+size_t Print::vprintf(const char *format, va_list ap)
+{
+  return printFormat(format, false, ap);
+}
+
+size_t Print::vprintf_P(PGM_P format, va_list ap)
+{
+  return printFormat(format, true, ap);
+}
+
 // Private Methods /////////////////////////////////////////////////////////////
 
-size_t Print::printNumber(unsigned long n, uint8_t base)
+// Collects output in a small buffer on the stack and passes it on to
+// the bulk write() of the Print in chunks.
+class PrintBuffer
 {
-  char buf[8 * sizeof(long) + 1]; // Assumes 8-bit chars plus zero byte.
-  char *str = &buf[sizeof(buf) - 1];
+  public:
+    PrintBuffer(Print &print) : _print(print), _len(0), _count(0) {}
 
-  *str = '\0';
+    void put(char c) {
+      if (_len == sizeof(_buf))
+        flush();
+      _buf[_len++] = c;
+    }
+    void put(const char *str, size_t len) {
+      while (len--)
+        put(*str++);
+    }
+    void repeat(char c, int count) {
+      while (count-- > 0)
+        put(c);
+    }
 
-  // prevent crash if called with base == 1
-  if (base < 2) base = 10;
+    // Writes out what is buffered, returns the total written so far
+    size_t flush() {
+      if (_len) {
+        _count += _print.write(_buf, _len);
+        _len = 0;
+      }
+      return _count;
+    }
 
-  do {
-    char c = n % base;
-    n /= base;
+  private:
+    Print &_print;
+    char _buf[16];
+    uint8_t _len;
+    size_t _count;
+};
+
+// printf flags
+#define FLAG_LEFT  0x01
+#define FLAG_ZERO  0x02
+#define FLAG_PLUS  0x04
+#define FLAG_SPACE 0x08
+#define FLAG_ALT   0x10
+
+// Writes what goes in front of a field of len characters: the padding,
+// sign and prefix. Returns the padding still to be written after the
+// field, for left aligned fields.
+static int putFieldStart(PrintBuffer &out, int len, int width, uint8_t flags,
+                         char sign, const char *prefix)
+{
+  if (sign) len++;
+  len += strlen(prefix);
+  int pad = width > len ? width - len : 0;
 
-    *--str = c < 10 ? c + '0' : c + 'A' - 10;
-  } while(n);
+  if (!(flags & (FLAG_LEFT | FLAG_ZERO))) {
+    out.repeat(' ', pad);
+    pad = 0;
+  }
+  if (sign) out.put(sign);
+  out.put(prefix, strlen(prefix));
+  if (!(flags & FLAG_LEFT)) {
+    out.repeat('0', pad);
+    pad = 0;
+  }
+  return pad;
+}
 
-  return write(str);
+// Powers of ten for formatDecimal(), largest first
+static const unsigned long powersOfTen[] PROGMEM = {
+  1000000000UL, 100000000UL, 10000000UL, 1000000UL,
+  100000UL, 10000UL, 1000UL, 100UL, 10UL
+};
+
+// Writes n in decimal so that it ends just before end, and returns
+// where it starts (at most 10 characters before end). Each digit is
+// found by subtracting powers of ten instead of dividing, since a
+// 32-bit division is a slow library call on AVR.
+static char *formatDecimal(char *end, unsigned long n)
+{
+  const uint8_t count = sizeof(powersOfTen) / sizeof(powersOfTen[0]);
+  uint8_t i = 0;
+
+  // Skip leading zeroes
+  while (i < count && n < pgm_read_dword(&powersOfTen[i]))
+    i++;
+
+  char *start = end - (count - i) - 1;
+  char *p = start;
+  for (; i < count; i++) {
+    unsigned long power = pgm_read_dword(&powersOfTen[i]);
+    char c = '0';
+    while (n >= power) {
+      n -= power;
+      c++;
+    }
+    *p++ = c;
+  }
+  *p = '0' + n;
+  return start;
 }
 
-size_t Print::printFloat(double number, uint8_t digits) 
-{ 
-  size_t n = 0;
-  
-  if (isnan(number)) return print("nan");
-  if (isinf(number)) return print("inf");
-  if (number > 4294967040.0) return print ("ovf");  // constant determined empirically
-  if (number <-4294967040.0) return print ("ovf");  // constant determined empirically
-  
+// Writes n in the given base so that it ends just before end, and
+// returns where it starts. alpha is the digit used for ten ('A' or 'a').
+static char *formatNumber(char *end, unsigned long n, uint8_t base, char alpha)
+{
+  if (base == 10)
+    return formatDecimal(end, n);
+
+  char *str = end;
+  // Power of two bases only need shifts and masks
+  uint8_t shift = base == 16 ? 4 : base == 8 ? 3 : base == 2 ? 1 : 0;
+  if (shift) {
+    uint8_t mask = base - 1;
+    do {
+      char c = n & mask;
+      n >>= shift;
+
+      *--str = c < 10 ? c + '0' : c + alpha - 10;
+    } while(n);
+  } else {
+    do {
+      char c = n % base;
+      n /= base;
+
+      *--str = c < 10 ? c + '0' : c + alpha - 10;
+    } while(n);
+  }
+  return str;
+}
+
+// Writes number with the given number of digits after the decimal
+// point, padded to width.
+static void putFloat(PrintBuffer &out, double number, uint8_t digits,
+                     int width, uint8_t flags)
+{
+  const char *special = NULL;
+  if (isnan(number)) special = "nan";
+  else if (isinf(number)) special = "inf";
+  // constant determined empirically
+  else if (number > 4294967040.0 || number < -4294967040.0) special = "ovf";
+  if (special) {
+    int pad = putFieldStart(out, 3, width, flags & ~FLAG_ZERO, 0, "");
+    out.put(special, 3);
+    out.repeat(' ', pad);
+    return;
+  }
+
   // Handle negative numbers
-  if (number < 0.0)
-  {
-     n += print('-');
-     number = -number;
+  char sign = 0;
+  if (number < 0.0) {
+    sign = '-';
+    number = -number;
+  } else if (flags & FLAG_PLUS) {
+    sign = '+';
+  } else if (flags & FLAG_SPACE) {
+    sign = ' ';
   }
 
   // Round correctly so that print(1.999, 2) prints as "2.00"
   double rounding = 0.5;
   for (uint8_t i=0; i<digits; ++i)
     rounding /= 10.0;
-  
+
   number += rounding;
 
-  // Extract the integer part of the number and print it
+  // Extract the integer part of the number
   unsigned long int_part = (unsigned long)number;
   double remainder = number - (double)int_part;
-  n += print(int_part);
+  char buf[10];
+  char *end = &buf[sizeof(buf)];
+  char *str = formatDecimal(end, int_part);
 
-  // Print the decimal point, but only if there are digits beyond
-  if (digits > 0) {
-    n += print('.'); 
-  }
+  // The decimal point is only printed if there are digits beyond
+  int len = (end - str) + (digits > 0 ? digits + 1 : 0);
+  int pad = putFieldStart(out, len, width, flags, sign, "");
+  out.put(str, end - str);
+  if (digits > 0)
+    out.put('.');
 
   // Extract digits from the remainder one at a time
   while (digits-- > 0)
   {
     remainder *= 10.0;
     unsigned int toPrint = (unsigned int)(remainder);
-    n += print(toPrint);
-    remainder -= toPrint; 
-  } 
-  
-  return n;
+    // remainder * 10 can round up to 10.0
+    if (toPrint > 9) toPrint = 9;
+    out.put('0' + toPrint);
+    remainder -= toPrint;
+  }
+  out.repeat(' ', pad);
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base)
+{
+  char buf[8 * sizeof(long)]; // Assumes 8-bit chars.
+  char *end = &buf[sizeof(buf)];
+
+  // prevent crash if called with base == 1
+  if (base < 2) base = 10;
+
+  char *str = formatNumber(end, n, base, 'A');
+  return write(str, end - str);
+}
+
+size_t Print::printFloat(double number, uint8_t digits) 
+{ 
+  PrintBuffer out(*this);
+  putFloat(out, number, digits, 0, 0);
+  return out.flush();
+}
+
+size_t Print::printFormat(const char *format, bool progmem, va_list ap)
+{
+  PrintBuffer out(*this);
+
+  while (1) {
+    char c = progmem ? pgm_read_byte(format++) : *format++;
+    if (c == '\0') break;
+    if (c != '%') {
+      out.put(c);
+      continue;
+    }
+
+    // Flags
+    uint8_t flags = 0;
+    while (1) {
+      c = progmem ? pgm_read_byte(format++) : *format++;
+      if (c == '-') flags |= FLAG_LEFT;
+      else if (c == '0') flags |= FLAG_ZERO;
+      else if (c == '+') flags |= FLAG_PLUS;
+      else if (c == ' ') flags |= FLAG_SPACE;
+      else if (c == '#') flags |= FLAG_ALT;
+      else break;
+    }
+
+    // Field width
+    int width = 0;
+    if (c == '*') {
+      width = va_arg(ap, int);
+      if (width < 0) {
+        flags |= FLAG_LEFT;
+        width = -width;
+      }
+      c = progmem ? pgm_read_byte(format++) : *format++;
+    } else {
+      while (c >= '0' && c <= '9') {
+        width = width * 10 + c - '0';
+        c = progmem ? pgm_read_byte(format++) : *format++;
+      }
+    }
+
+    // Precision, -1 when not given
+    int prec = -1;
+    if (c == '.') {
+      prec = 0;
+      c = progmem ? pgm_read_byte(format++) : *format++;
+      if (c == '*') {
+        prec = va_arg(ap, int);
+        if (prec < 0) prec = -1;
+        c = progmem ? pgm_read_byte(format++) : *format++;
+      } else {
+        while (c >= '0' && c <= '9') {
+          prec = prec * 10 + c - '0';
+          c = progmem ? pgm_read_byte(format++) : *format++;
+        }
+      }
+    }
+
+    // Length modifiers. Arguments shorter than int are promoted anyway.
+    bool isLong = false;
+    while (c == 'l' || c == 'h') {
+      if (c == 'l') isLong = true;
+      c = progmem ? pgm_read_byte(format++) : *format++;
+    }
+
+    char buf[11]; // Enough for a 32-bit value in octal
+    char *end = &buf[sizeof(buf)];
+    int pad;
+    switch (c) {
+      case 'c':
+        buf[0] = (char)va_arg(ap, int);
+        pad = putFieldStart(out, 1, width, flags & ~FLAG_ZERO, 0, "");
+        out.put(buf[0]);
+        out.repeat(' ', pad);
+        break;
+
+      case 's': {
+        const char *str = va_arg(ap, const char *);
+        if (str == NULL) str = "(null)";
+        size_t len = 0;
+        while (str[len] && (prec < 0 || len < (size_t)prec))
+          len++;
+        pad = putFieldStart(out, len, width, flags & ~FLAG_ZERO, 0, "");
+        out.put(str, len);
+        out.repeat(' ', pad);
+        break;
+      }
+
+      case 'd':
+      case 'i':
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o': {
+        unsigned long n;
+        char sign = 0;
+        if (c == 'd' || c == 'i') {
+          long v = isLong ? va_arg(ap, long) : va_arg(ap, int);
+          if (v < 0) {
+            sign = '-';
+            n = -(unsigned long)v;
+          } else {
+            sign = (flags & FLAG_PLUS) ? '+' : (flags & FLAG_SPACE) ? ' ' : 0;
+            n = v;
+          }
+        } else {
+          n = isLong ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+        }
+
+        uint8_t base = (c == 'x' || c == 'X') ? 16 : c == 'o' ? 8 : 10;
+        char *str = formatNumber(end, n, base, c == 'x' ? 'a' : 'A');
+        int len = end - str;
+        // An explicit precision of zero prints nothing for zero
+        if (prec == 0 && n == 0) len = 0;
+
+        const char *prefix = "";
+        if ((flags & FLAG_ALT) && n != 0) {
+          if (c == 'x') prefix = "0x";
+          else if (c == 'X') prefix = "0X";
+        }
+        // The alternate form of octal starts with a 0, unless the
+        // number does already
+        if ((flags & FLAG_ALT) && c == 'o' && (len == 0 || str[0] != '0') && prec <= len)
+          prec = len + 1;
+
+        // Zero padding is done through the precision when one is given
+        if (prec >= 0) flags &= ~FLAG_ZERO;
+        int zeros = prec > len ? prec - len : 0;
+        pad = putFieldStart(out, len + zeros, width, flags, sign, prefix);
+        out.repeat('0', zeros);
+        out.put(str, len);
+        out.repeat(' ', pad);
+        break;
+      }
+
+      case 'f':
+      case 'F': {
+        double v = va_arg(ap, double);
+#ifndef PRINTF_NO_FLOAT
+        putFloat(out, v, prec < 0 ? 6 : prec, width, flags);
+#else
+        (void)v;
+        out.put('?');
+#endif
+        break;
+      }
+
+      case '\0':
+        // Format ends in the middle of a conversion
+        return out.flush();
+
+      case 'e':
+      case 'E':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        // Not supported, but the argument must still be skipped
+        (void)va_arg(ap, double);
+        out.put('?');
+        break;
+
+      case 'p':
+        (void)va_arg(ap, void *);
+        out.put('?');
+        break;
+
+      case 'n':
+        (void)va_arg(ap, void *);
+        break;
+
+      case '%':
+        out.put('%');
+        break;
+
+      default:
+        // Unknown, and so is its argument if it has one
+        out.put('?');
+        break;
+    }
+  }
+
+  return out.flush();
 }
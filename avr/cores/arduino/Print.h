@@ -22,6 +22,7 @@
 
 #include <inttypes.h>
 #include <stdio.h> // for size_t
+#include <stdarg.h> // for va_list
 
 #include "WString.h"
 #include "Printable.h"
@@ -40,6 +41,7 @@ class Print
     int write_error;
     size_t printNumber(unsigned long, uint8_t);
     size_t printFloat(double, uint8_t);
+    size_t printFormat(const char *, bool, va_list);
   protected:
     void setWriteError(int err = 1) { write_error = err; }
   public:
@@ -87,6 +89,19 @@ class Print
     size_t println(const Printable&);
     size_t println(void);
 
+    // Formatted output, written in small chunks through write(buffer,
+    // size) without using the heap. Supports the flags -0+ #, width
+    // and precision (also as *), the l and h modifiers and the %c %s
+    // %d %i %u %x %X %o %f conversions. Define PRINTF_NO_FLOAT to
+    // leave out %f, which then prints "?" and does not pull in the
+    // floating point code. Other conversions (%e, %g, %p...) print "?"
+    // as well, and skip their argument.
+    size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+    size_t printf(const __FlashStringHelper *format, ...);
+    size_t printf_P(PGM_P format, ...);
+    size_t vprintf(const char *format, va_list ap);
+    size_t vprintf_P(PGM_P format, va_list ap);
+
     virtual void flush() { /* Empty implementation for backward compatibility */ }
 };
 
@@ -0,0 +1,77 @@
+/*
+  StaticString.h - String with fixed storage, for Wiring & Arduino
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef StaticString_h
+#define StaticString_h
+#ifdef __cplusplus
+
+#include "WString.h"
+#include "Print.h"
+
+// A String that holds up to N - 1 characters in an array inside the
+// object and never uses the heap. It has all String methods, and can
+// be printed to like a Serial port:
+//
+//   StaticString<32> line;
+//   line.print(F("t="));
+//   line.println(millis());
+//
+// Operations that don't fit leave the string unchanged, like they do
+// for a String that runs out of memory, except for assignments that
+// leave it empty. Instead of invalidating the string, this sets the
+// overflow() flag. Writes through Print store as much as fits.
+//
+// Methods returning a new String (substring(), operator +) still
+// return a regular, heap based String.
+template<size_t N>
+class StaticString : public String, public Print
+{
+public:
+	StaticString() : String(storage, N - 1) {}
+	StaticString(const StaticString &str) : String(storage, N - 1) { *this = str; }
+	StaticString(const String &str) : String(storage, N - 1) { *this = str; }
+	StaticString(const char *cstr) : String(storage, N - 1) { *this = cstr; }
+	StaticString(const __FlashStringHelper *str) : String(storage, N - 1) { *this = str; }
+
+	StaticString & operator = (const StaticString &rhs) { String::operator = (rhs); return *this; }
+	using String::operator =;
+
+	// true if something did not fit since the last clearOverflow()
+	bool overflow(void) const { return overflowed; }
+	void clearOverflow(void) { overflowed = 0; }
+
+	using Print::write;
+	virtual size_t write(uint8_t c) { return write(&c, 1); }
+	virtual size_t write(const uint8_t *data, size_t size) {
+		if (size > ptr.cap - ptr.len) {
+			size = ptr.cap - ptr.len;
+			overflowed = 1;
+		}
+		memcpy(ptr.buff + ptr.len, data, size);
+		ptr.len += size;
+		ptr.buff[ptr.len] = 0;
+		return size;
+	}
+	virtual int availableForWrite() { return ptr.cap - ptr.len; }
+
+private:
+	char storage[N];
+};
+
+#endif  // __cplusplus
+#endif  // StaticString_h
@@ -35,6 +35,7 @@ int Stream::timedRead()
   do {
     c = read();
     if (c >= 0) return c;
+    yield();
   } while(millis() - _startMillis < _timeout);
   return -1;     // -1 indicates timeout
 }
@@ -47,6 +48,7 @@ int Stream::timedPeek()
   do {
     c = peek();
     if (c >= 0) return c;
+    yield();
   } while(millis() - _startMillis < _timeout);
   return -1;     // -1 indicates timeout
 }
@@ -84,6 +86,19 @@ int Stream::peekNextDigit(LookaheadMode lookahead, bool detectDecimal)
 // Public Methods
 //////////////////////////////////////////////////////////////
 
+/* default implementation: may be overridden */
+int Stream::read(uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  while (count < size) {
+    int c = read();
+    if (c < 0) break;
+    *buffer++ = (uint8_t)c;
+    count++;
+  }
+  return count;
+}
+
 void Stream::setTimeout(unsigned long timeout)  // sets the maximum number of milliseconds to wait
 {
   _timeout = timeout;
@@ -203,10 +218,16 @@ size_t Stream::readBytes(char *buffer, size_t length)
 {
   size_t count = 0;
   while (count < length) {
+    // Copy everything that is already available in one go, and only
+    // wait for the next byte (with timeout) when nothing is.
+    int n = read((uint8_t *)buffer + count, length - count);
+    if (n > 0) {
+      count += n;
+      continue;
+    }
     int c = timedRead();
     if (c < 0) break;
-    *buffer++ = (char)c;
-    count++;
+    buffer[count++] = (char)c;
   }
   return count;
 }
@@ -260,59 +281,365 @@ int Stream::findMulti( struct Stream::MultiTarget *targets, int tCount) {
       return t - targets;
   }
 
+  // Two or more targets are searched for with an automaton when it fits
+  // in FIND_MULTI_MAX_NODES. Larger sets take the loop below, which needs
+  // no memory; build a MultiMatcher for those and use findMulti(matcher).
+  int found;
+  if (tCount > 1 && findMultiSmall(targets, tCount, found))
+    return found;
+
   while (1) {
     int c = timedRead();
     if (c < 0)
       return -1;
 
-    for (struct MultiTarget *t = targets; t < targets+tCount; ++t) {
-      // the simple case is if we match, deal with that first.
-      if (c == t->str[t->index]) {
-        if (++t->index == t->len)
-          return t - targets;
-        else
-          continue;
-      }
+    found = findMultiStep(targets, tCount, c);
+    if (found >= 0)
+      return found;
+  }
+  // unreachable
+  return -1;
+}
+
+// Searches with an automaton on the stack, if the targets fit in it.
+// Kept out of findMulti() so find() with a single target doesn't reserve
+// the stack for it.
+bool Stream::findMultiSmall(struct MultiTarget *targets, int tCount, int &found) {
+  StaticMultiMatcher<FIND_MULTI_MAX_NODES> matcher;
+  if (!matcher.begin(targets, tCount))
+    return false;
+  found = findMulti(matcher);
+  return true;
+}
+
+int Stream::findMulti(MultiMatcher &matcher) {
+  matcher.reset();
+  while (1) {
+    int c = timedRead();
+    if (c < 0)
+      return -1;
+
+    int found = matcher.feed(c);
+    if (found >= 0)
+      return found;
+  }
+  // unreachable
+  return -1;
+}
 
-      // if not we need to walk back and see if we could have matched further
-      // down the stream (ie '1112' doesn't match the first position in '11112'
-      // but it will match the second position so we can't just reset the current
-      // index to 0 when we find a mismatch.
-      if (t->index == 0)
+int Stream::findMultiStep(struct MultiTarget *targets, int tCount, char c) {
+  for (struct MultiTarget *t = targets; t < targets+tCount; ++t) {
+    // the simple case is if we match, deal with that first.
+    if (c == t->str[t->index]) {
+      if (++t->index == t->len)
+        return t - targets;
+      else
         continue;
+    }
 
-      int origIndex = t->index;
-      do {
-        --t->index;
-        // first check if current char works against the new current index
-        if (c != t->str[t->index])
-          continue;
+    // if not we need to walk back and see if we could have matched further
+    // down the stream (ie '1112' doesn't match the first position in '11112'
+    // but it will match the second position so we can't just reset the current
+    // index to 0 when we find a mismatch.
+    if (t->index == 0)
+      continue;
+
+    int origIndex = t->index;
+    do {
+      --t->index;
+      // first check if current char works against the new current index
+      if (c != t->str[t->index])
+        continue;
+
+      // if it's the only char then we're good, nothing more to check
+      if (t->index == 0) {
+        t->index++;
+        break;
+      }
 
-        // if it's the only char then we're good, nothing more to check
-        if (t->index == 0) {
-          t->index++;
+      // otherwise we need to check the rest of the found string
+      int diff = origIndex - t->index;
+      size_t i;
+      for (i = 0; i < t->index; ++i) {
+        if (t->str[i] != t->str[i + diff])
           break;
-        }
+      }
 
-        // otherwise we need to check the rest of the found string
-        int diff = origIndex - t->index;
-        size_t i;
-        for (i = 0; i < t->index; ++i) {
-          if (t->str[i] != t->str[i + diff])
-            break;
-        }
+      // if we successfully got through the previous loop then our current
+      // index is good.
+      if (i == t->index) {
+        t->index++;
+        break;
+      }
 
-        // if we successfully got through the previous loop then our current
-        // index is good.
-        if (i == t->index) {
-          t->index++;
-          break;
-        }
+      // otherwise we just try the next index
+    } while (t->index);
+  }
+  return -1;
+}
 
-        // otherwise we just try the next index
-      } while (t->index);
+// MultiMatcher
+//////////////////////////////////////////////////////////////
+
+bool MultiMatcher::begin(const struct Stream::MultiTarget *targets, int tCount)
+{
+  _count = 0;
+  _state = 0;
+  if (tCount > 127 || _max < 1)
+    return false;
+  _count = 1;
+  _nodes[0].child = 0;
+  _nodes[0].fail = 0;
+  _nodes[0].match = -1;
+
+  // Build a trie of the targets one level at a time, so the nodes are
+  // numbered in breadth first order
+  size_t maxLen = 0;
+  for (int t = 0; t < tCount; t++) {
+    if (targets[t].len > maxLen)
+      maxLen = targets[t].len;
+  }
+  for (size_t depth = 0; depth < maxLen; depth++) {
+    for (int t = 0; t < tCount; t++) {
+      if (targets[t].len <= depth)
+        continue;
+      uint8_t node = 0;
+      for (size_t i = 0; i < depth; i++)
+        node = child(node, targets[t].str[i]);
+      char c = targets[t].str[depth];
+      uint8_t next = child(node, c);
+      if (!next) {
+        if (_count >= _max)
+          return false;
+        next = _count++;
+        _nodes[next].c = c;
+        _nodes[next].child = 0;
+        _nodes[next].sibling = _nodes[node].child;
+        _nodes[next].match = -1;
+        _nodes[node].child = next;
+      }
+      if (depth + 1 == targets[t].len && _nodes[next].match < 0)
+        _nodes[next].match = t;
     }
   }
-  // unreachable
-  return -1;
+
+  // Set the fail links. In breadth first order, the less deep nodes they
+  // point to are done first.
+  for (uint8_t node = 0; node < _count; node++) {
+    for (uint8_t n = _nodes[node].child; n; n = _nodes[n].sibling) {
+      uint8_t next = 0;
+      if (node) {
+        uint8_t f = _nodes[node].fail;
+        while (!(next = child(f, _nodes[n].c)) && f)
+          f = _nodes[f].fail;
+      }
+      _nodes[n].fail = next;
+
+      // A target that ends in a suffix ends here as well
+      int8_t match = _nodes[next].match;
+      if (match >= 0 && (_nodes[n].match < 0 || match < _nodes[n].match))
+        _nodes[n].match = match;
+    }
+  }
+  return true;
+}
+
+uint8_t MultiMatcher::child(uint8_t node, char c) const
+{
+  for (uint8_t n = _nodes[node].child; n; n = _nodes[n].sibling) {
+    if (_nodes[n].c == c)
+      return n;
+  }
+  return 0;
+}
+
+int MultiMatcher::feed(char c)
+{
+  uint8_t node = _state;
+  uint8_t next;
+  // Fall back to shorter suffixes until one can be extended by c. Each
+  // step makes the match shorter, so this averages out to at most one
+  // step per character.
+  while (!(next = child(node, c)) && node)
+    node = _nodes[node].fail;
+  _state = next;
+  return _nodes[next].match;
+}
+
+// StreamParser
+//////////////////////////////////////////////////////////////
+
+void StreamParser::expectInt(LookaheadMode lookahead, char ignore)
+{
+  _kind = INT;
+  _lookahead = lookahead;
+  _ignore = ignore;
+  start();
+}
+
+void StreamParser::expectFloat(LookaheadMode lookahead, char ignore)
+{
+  _kind = FLOAT;
+  _lookahead = lookahead;
+  _ignore = ignore;
+  start();
+}
+
+void StreamParser::expectField(char delimiter, char *buffer, size_t size)
+{
+  _kind = FIELD;
+  _ignore = delimiter;
+  _buffer = buffer;
+  _size = size;
+  start();
+}
+
+void StreamParser::expectMulti(struct Stream::MultiTarget *targets, int tCount)
+{
+  _kind = MULTI;
+  _targets = targets;
+  _tCount = tCount;
+  start();
+}
+
+void StreamParser::expectMulti(MultiMatcher &matcher)
+{
+  _kind = MATCHER;
+  _matcher = &matcher;
+  start();
+}
+
+// resets the state for a new token
+void StreamParser::start()
+{
+  _status = PENDING;
+  _started = false;
+  _negative = false;
+  _fraction = false;
+  _value = 0;
+  _scale = 1.0;
+  _length = 0;
+  _match = -1;
+  if (_kind == FIELD && _size)
+    _buffer[0] = 0;
+  if (_kind == MULTI) {
+    for (int i = 0; i < _tCount; i++)
+      _targets[i].index = 0;
+  }
+  if (_kind == MATCHER)
+    _matcher->reset();
+}
+
+StreamParser::Status StreamParser::poll(Stream &stream)
+{
+  if (_status != PENDING)
+    start();
+
+  // a zero length target matches without any input, like in findMulti()
+  if (_kind == MULTI) {
+    for (int i = 0; i < _tCount; i++) {
+      if (_targets[i].len == 0) {
+        _match = i;
+        return (Status)(_status = DONE);
+      }
+    }
+  }
+
+  while (stream.available() > 0) {
+    int c = stream.peek();
+    if (c < 0)
+      break;
+    bool consumed;
+    Status status = step(c, consumed);
+    if (consumed)
+      stream.read();
+    if (status != PENDING)
+      return status;
+  }
+  return PENDING;
+}
+
+StreamParser::Status StreamParser::feed(char c)
+{
+  if (_status != PENDING)
+    start();
+  bool consumed;
+  return step((unsigned char)c, consumed);
+}
+
+// Handles one character, sets consumed when it is part of the token
+StreamParser::Status StreamParser::step(int c, bool &consumed)
+{
+  consumed = true;
+  switch (_kind) {
+    case INT:
+    case FLOAT:
+      if (!_started) {
+        // like peekNextDigit()
+        if (c == '-' || (c >= '0' && c <= '9') || (_kind == FLOAT && c == '.')) {
+          _started = true;
+        } else {
+          switch (_lookahead) {
+            case SKIP_NONE:
+              consumed = false;
+              return (Status)(_status = FAILED);
+            case SKIP_WHITESPACE:
+              if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                consumed = false;
+                return (Status)(_status = FAILED);
+              }
+              break;
+          }
+          return PENDING;  // discard non-numeric
+        }
+        // like the first iteration in parseInt(), which accepts '-'
+        if (c == '-') {
+          _negative = true;
+          return PENDING;
+        }
+      }
+      // like parseInt() and parseFloat()
+      if (c == _ignore) {
+        ; // ignore this character
+      } else if (c >= '0' && c <= '9') {
+        _value = _value * 10 + c - '0';
+        if (_fraction)
+          _scale *= 0.1;
+      } else if (_kind == FLOAT && c == '.' && !_fraction) {
+        _fraction = true;
+      } else {
+        consumed = false;
+        return (Status)(_status = DONE);
+      }
+      return PENDING;
+
+    case FIELD:
+      // no room for even one character
+      if (_size < 2) {
+        consumed = false;
+        return (Status)(_status = FAILED);
+      }
+      if (c == _ignore)
+        return (Status)(_status = DONE);
+      if (_length + 1 < _size) {
+        _buffer[_length++] = c;
+        _buffer[_length] = 0;
+      }
+      if (_length + 1 >= _size)
+        return (Status)(_status = DONE);
+      return PENDING;
+
+    case MULTI:
+      _match = Stream::findMultiStep(_targets, _tCount, c);
+      if (_match >= 0)
+        return (Status)(_status = DONE);
+      return PENDING;
+
+    case MATCHER:
+      _match = _matcher->feed(c);
+      if (_match >= 0)
+        return (Status)(_status = DONE);
+      return PENDING;
+  }
+  return PENDING;
 }
@@ -46,6 +46,8 @@ enum LookaheadMode{
 
 #define NO_IGNORE_CHAR  '\x01' // a char not found in a valid ASCII numeric field
 
+class MultiMatcher;
+
 class Stream : public Print
 {
   protected:
@@ -59,9 +61,23 @@ class Stream : public Print
     virtual int available() = 0;
     virtual int read() = 0;
     virtual int peek() = 0;
+    // Copy up to size bytes that are already available into buffer,
+    // without waiting. Returns the number of bytes copied. The default
+    // calls read() for each byte, buffered streams should override it.
+    virtual int read(uint8_t *buffer, size_t size);
 
     Stream() {_timeout=1000;}
 
+    struct MultiTarget {
+      const char *str;  // string you're searching for
+      size_t len;       // length of string you're searching for
+      size_t index;     // index used by the search routine.
+    };
+
+    // Advances the search of findMulti() by one character. Returns the
+    // index of the target that c completes, or -1.
+    static int findMultiStep(struct MultiTarget *targets, int tCount, char c);
+
 // parsing methods
 
   void setTimeout(unsigned long timeout);  // sets maximum milliseconds to wait for stream data, default is 1 second
@@ -83,6 +99,10 @@ class Stream : public Print
   bool findUntil(char *target, size_t targetLen, char *terminate, size_t termLen);   // as above but search ends if the terminate string is found
   bool findUntil(uint8_t *target, size_t targetLen, char *terminate, size_t termLen) {return findUntil((char *)target, targetLen, terminate, termLen); }
 
+  int findMulti(MultiMatcher &matcher);   // reads data from the stream until any of the strings of matcher is found
+  // returns the index of the string found, or -1 if timed out. Build matcher once
+  // with begin() and reuse it, rather than searching for many strings with findMulti()
+
   long parseInt(LookaheadMode lookahead = SKIP_ALL, char ignore = NO_IGNORE_CHAR);
   // returns the first valid (long) integer value from the current position.
   // lookahead determines how parseInt looks ahead in the stream.
@@ -114,15 +134,151 @@ class Stream : public Print
   // Stream and used parseFloat/Int with a custom ignore character. To keep
   // the public API simple, these overload remains protected.
 
-  struct MultiTarget {
-    const char *str;  // string you're searching for
-    size_t len;       // length of string you're searching for
-    size_t index;     // index used by the search routine.
-  };
-
   // This allows you to search for an arbitrary number of strings.
   // Returns index of the target that is found first or -1 if timeout occurs.
   int findMulti(struct MultiTarget *targets, int tCount);
+
+  private:
+  bool findMultiSmall(struct MultiTarget *targets, int tCount, int &found) __attribute__((noinline));
+};
+
+// Largest automaton findMulti() builds on the stack for two or more
+// targets, in nodes of 5 bytes
+#ifndef FIND_MULTI_MAX_NODES
+#define FIND_MULTI_MAX_NODES 16
+#endif
+
+// Aho-Corasick automaton for finding any of a number of strings in a
+// stream of characters, at a constant cost per character (amortized)
+// however many strings there are. Build it once and pass it to
+// Stream::findMulti(), or feed it directly for non-blocking use:
+//
+//   Stream::MultiTarget targets[] = {{"OK", 2, 0}, {"ERROR", 5, 0}};
+//   StaticMultiMatcher<8> matcher;
+//   matcher.begin(targets, 2);
+//   ...
+//   int found = Serial.findMulti(matcher);
+//   ...
+//   while (Serial.available()) {
+//     int found = matcher.feed(Serial.read());
+//     if (found >= 0) ...
+//   }
+//
+// The automaton needs one node per distinct prefix of the strings, plus
+// one, so at most the total length of the strings plus one.
+class MultiMatcher
+{
+  public:
+    struct Node {
+      char c;          // character leading to this node
+      uint8_t child;   // first child, 0 if none
+      uint8_t sibling; // next child of the same parent, 0 if none
+      uint8_t fail;    // node for the longest proper suffix that is a prefix
+      int8_t match;    // lowest target index ending here (or in a suffix), or -1
+    };
+
+    MultiMatcher(Node *nodes, uint8_t maxNodes) : _nodes(nodes), _max(maxNodes), _count(0), _state(0) {}
+
+    // Builds the automaton for the given targets (their index fields are
+    // not used). Returns false when there are more nodes than fit, or
+    // more than 127 targets. Empty targets are never found.
+    bool begin(const struct Stream::MultiTarget *targets, int tCount);
+    // Advances by one character. Returns the index of the target that
+    // ends with c (the lowest one when several do), or -1.
+    int feed(char c);
+    // Forgets the characters fed so far
+    void reset() { _state = 0; }
+
+  private:
+    Node *_nodes;
+    uint8_t _max;
+    uint8_t _count;
+    uint8_t _state;
+    uint8_t child(uint8_t node, char c) const;
+};
+
+template<uint8_t MAX_NODES>
+class StaticMultiMatcher : public MultiMatcher
+{
+  public:
+    StaticMultiMatcher() : MultiMatcher(_storage, MAX_NODES) {}
+  private:
+    Node _storage[MAX_NODES];
+};
+
+// Non-blocking version of the parsing methods of Stream. Select what to
+// parse next with one of the expect methods, then call poll() whenever
+// convenient (e.g. from loop()). It only uses the characters that are
+// already available, keeps its state between calls and returns DONE
+// once the token is complete:
+//
+//   StreamParser parser;
+//   parser.expectInt();
+//   ...
+//   while (parser.poll(Serial) == StreamParser::DONE)
+//     handle(parser.intValue());
+//
+// After DONE or FAILED, the next poll() starts a new token of the same
+// kind. Like parseInt(), the character that ends a number is left in
+// the stream.
+class StreamParser
+{
+  public:
+    enum Status {
+      PENDING, // more input is needed
+      DONE,    // a token is complete
+      FAILED   // input didn't match, see expectInt()
+    };
+
+    StreamParser() { expectInt(); }
+
+    // An integer or float, like parseInt() and parseFloat(). Using
+    // SKIP_NONE or SKIP_WHITESPACE, poll() returns FAILED when another
+    // character comes first (and leaves it in the stream).
+    void expectInt(LookaheadMode lookahead = SKIP_ALL, char ignore = NO_IGNORE_CHAR);
+    void expectFloat(LookaheadMode lookahead = SKIP_ALL, char ignore = NO_IGNORE_CHAR);
+    // The characters up to delimiter (which is consumed but not stored),
+    // like readBytesUntil(). The field is zero terminated, a field that
+    // doesn't fit is returned in parts of size - 1 characters. size must
+    // be at least 2, poll() returns FAILED otherwise.
+    void expectField(char delimiter, char *buffer, size_t size);
+    // Any of the given targets, like findMulti()
+    void expectMulti(struct Stream::MultiTarget *targets, int tCount);
+    // Any of the targets of a matcher that was set up with begin(). This
+    // costs less per character than the above with many targets.
+    void expectMulti(MultiMatcher &matcher);
+
+    Status poll(Stream &stream);
+    // For input that doesn't come from a Stream. c is always consumed,
+    // including the one that ends a number.
+    Status feed(char c);
+
+    long intValue() const { return _negative ? -_value : _value; }
+    float floatValue() const { return _fraction ? intValue() * _scale : intValue(); }
+    size_t fieldLength() const { return _length; }
+    int matchIndex() const { return _match; }
+
+  private:
+    enum Kind { INT, FLOAT, FIELD, MULTI, MATCHER };
+    uint8_t _kind;
+    uint8_t _status;      // of the last token, a new one starts after DONE/FAILED
+    bool _started;        // a token has started: digits or field characters seen
+    bool _negative;
+    bool _fraction;
+    char _lookahead;      // LookaheadMode for numbers
+    char _ignore;         // ignored character for numbers, delimiter for fields
+    long _value;
+    float _scale;
+    char *_buffer;
+    size_t _size;
+    size_t _length;
+    struct Stream::MultiTarget *_targets;
+    int _tCount;
+    MultiMatcher *_matcher;
+    int _match;
+
+    void start();
+    Status step(int c, bool &consumed);
 };
 
 #undef NO_IGNORE_CHAR
@@ -136,9 +136,10 @@ static int8_t toneBegin(uint8_t _pin)
     }
   }
   
-  // search for an unused timer.
+  // search for an unused timer, that nothing else uses either.
   for (int i = 0; i < AVAILABLE_TONE_PINS; i++) {
-    if (tone_pins[i] == 255) {
+    if (tone_pins[i] == 255 &&
+        timerClaim(pgm_read_byte(tone_pin_to_timer_PGM + i), TIMER_OWNER_TONE)) {
       tone_pins[i] = _pin;
       _timer = pgm_read_byte(tone_pin_to_timer_PGM + i);
       break;
@@ -490,6 +491,7 @@ void noTone(uint8_t _pin)
   }
   
   disableTimer(_timer);
+  timerRelease(_timer, TIMER_OWNER_TONE);
 
   digitalWrite(_pin, 0);
 }
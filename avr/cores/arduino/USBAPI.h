@@ -100,6 +100,7 @@ public:
 	virtual int available(void);
 	virtual int peek(void);
 	virtual int read(void);
+	virtual int read(uint8_t *buffer, size_t size);
 	virtual int availableForWrite(void);
 	virtual void flush(void);
 	virtual size_t write(uint8_t);
@@ -119,9 +119,20 @@ String::String(double value, unsigned char decimalPlaces)
 	*this = dtostrf(value, (decimalPlaces + 2), decimalPlaces, buf);
 }
 
+String::String(char *fixedBuffer, unsigned int fixedCapacity)
+{
+	ptr.buff = fixedBuffer;
+	ptr.buff[0] = 0;
+	ptr.cap = fixedCapacity;
+	ptr.len = 0;
+	isInline = 0;
+	fixed = 1;
+	overflowed = 0;
+}
+
 String::~String()
 {
-	if (buffer) free(buffer);
+	if (!isInline && !fixed) free(ptr.buff);
 }
 
 /*********************************************/
@@ -130,37 +141,81 @@ String::~String()
 
 inline void String::init(void)
 {
-	buffer = NULL;
-	capacity = 0;
-	len = 0;
+	ptr.buff = NULL;
+	ptr.cap = 0;
+	ptr.len = 0;
+	isInline = 0;
+	fixed = 0;
+	overflowed = 0;
 }
 
 void String::invalidate(void)
 {
-	if (buffer) free(buffer);
-	buffer = NULL;
-	capacity = len = 0;
+	if (fixed) {
+		// A fixed buffer stays valid, the failure is only flagged
+		ptr.buff[0] = 0;
+		ptr.len = 0;
+		overflowed = 1;
+		return;
+	}
+	if (!isInline) free(ptr.buff);
+	init();
 }
 
 unsigned char String::reserve(unsigned int size)
 {
-	if (buffer && capacity >= size) return 1;
+	if (buffer() && capacity() >= size) return 1;
 	if (changeBuffer(size)) {
-		if (len == 0) buffer[0] = 0;
+		if (len() == 0) buffer()[0] = 0;
 		return 1;
 	}
 	return 0;
 }
 
+// Like reserve(), but grows the buffer by half its size at least, so a
+// string built up by repeated concatenation is only reallocated a few
+// times.
+unsigned char String::grow(unsigned int size)
+{
+	if (buffer() && capacity() >= size) return 1;
+	unsigned int newCapacity = capacity() + (capacity() >> 1);
+	if (newCapacity > size && changeBuffer(newCapacity)) {
+		if (len() == 0) buffer()[0] = 0;
+		return 1;
+	}
+	// Not enough memory for the extra room, try the exact size
+	return reserve(size);
+}
+
 unsigned char String::changeBuffer(unsigned int maxStrLen)
 {
-	char *newbuffer = (char *)realloc(buffer, maxStrLen + 1);
-	if (newbuffer) {
-		buffer = newbuffer;
-		capacity = maxStrLen;
+	if (fixed) {
+		overflowed = 1;
+		return 0;
+	}
+	// Only ever called to grow the buffer, so a heap buffer never
+	// moves back inline
+	if (!buffer() && maxStrLen < sizeof(sso)) {
+		isInline = 1;
+		ssoLen = 0;
 		return 1;
 	}
-	return 0;
+	char *newbuffer;
+	if (isInline) {
+		// sso and ptr share their bytes, so copy out before setting ptr
+		newbuffer = (char *)malloc(maxStrLen + 1);
+		if (!newbuffer) return 0;
+		unsigned int length = ssoLen;
+		memcpy(newbuffer, sso, length + 1);
+		isInline = 0;
+		ptr.len = length;
+	} else {
+		newbuffer = (char *)realloc(ptr.buff, maxStrLen + 1);
+		if (!newbuffer) return 0;
+	}
+	ptr.buff = newbuffer;
+	ptr.cap = maxStrLen;
+	return 1;
 }
 
 /*********************************************/
@@ -173,8 +228,9 @@ String & String::copy(const char *cstr, unsigned int length)
 		invalidate();
 		return *this;
 	}
-	len = length;
-	strcpy(buffer, cstr);
+	setLen(length);
+	memcpy(buffer(), cstr, length);
+	buffer()[length] = 0;
 	return *this;
 }
 
@@ -184,30 +240,37 @@ String & String::copy(const __FlashStringHelper *pstr, unsigned int length)
 		invalidate();
 		return *this;
 	}
-	len = length;
-	strcpy_P(buffer, (PGM_P)pstr);
+	setLen(length);
+	strcpy_P(buffer(), (PGM_P)pstr);
 	return *this;
 }
 
 #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
 void String::move(String &rhs)
 {
-	if (buffer) {
-		if (rhs && capacity >= rhs.len) {
-			strcpy(buffer, rhs.buffer);
-			len = rhs.len;
-			rhs.len = 0;
+	if (rhs.isInline || rhs.fixed || fixed) {
+		// Only heap buffers can be taken over, copy anything else
+		if (rhs) copy(rhs.buffer(), rhs.len());
+		else invalidate();
+		if (rhs) {
+			rhs.setLen(0);
+			rhs.buffer()[0] = 0;
+		}
+		return;
+	}
+	if (buffer()) {
+		if (rhs && capacity() >= rhs.len()) {
+			strcpy(buffer(), rhs.buffer());
+			setLen(rhs.len());
+			rhs.setLen(0);
 			return;
-		} else {
-			free(buffer);
+		} else if (!isInline) {
+			free(ptr.buff);
 		}
 	}
-	buffer = rhs.buffer;
-	capacity = rhs.capacity;
-	len = rhs.len;
-	rhs.buffer = NULL;
-	rhs.capacity = 0;
-	rhs.len = 0;
+	isInline = 0;
+	ptr = rhs.ptr;
+	rhs.init();
 }
 #endif
 
@@ -215,7 +278,7 @@ String & String::operator = (const String &rhs)
 {
 	if (this == &rhs) return *this;
 	
-	if (rhs.buffer) copy(rhs.buffer, rhs.len);
+	if (rhs.buffer()) copy(rhs.buffer(), rhs.len());
 	else invalidate();
 	
 	return *this;
@@ -257,17 +320,26 @@ String & String::operator = (const __FlashStringHelper *pstr)
 
 unsigned char String::concat(const String &s)
 {
-	return concat(s.buffer, s.len);
+	return concat(s.buffer(), s.len());
 }
 
 unsigned char String::concat(const char *cstr, unsigned int length)
 {
-	unsigned int newlen = len + length;
+	unsigned int newlen = len() + length;
 	if (!cstr) return 0;
 	if (length == 0) return 1;
-	if (!reserve(newlen)) return 0;
-	strcpy(buffer + len, cstr);
-	len = newlen;
+	// cstr may be part of this string, which moves when it grows
+	const char *old = buffer();
+	if (old && cstr >= old && cstr <= old + len()) {
+		unsigned int offset = cstr - old;
+		if (!grow(newlen)) return 0;
+		cstr = buffer() + offset;
+	} else if (!grow(newlen)) {
+		return 0;
+	}
+	memmove(buffer() + len(), cstr, length);
+	setLen(newlen);
+	buffer()[newlen] = 0;
 	return 1;
 }
 
@@ -339,10 +411,10 @@ unsigned char String::concat(const __FlashStringHelper * str)
 	if (!str) return 0;
 	int length = strlen_P((const char *) str);
 	if (length == 0) return 1;
-	unsigned int newlen = len + length;
-	if (!reserve(newlen)) return 0;
-	strcpy_P(buffer + len, (const char *) str);
-	len = newlen;
+	unsigned int newlen = len() + length;
+	if (!grow(newlen)) return 0;
+	strcpy_P(buffer() + len(), (const char *) str);
+	setLen(newlen);
 	return 1;
 }
 
@@ -353,7 +425,7 @@ unsigned char String::concat(const __FlashStringHelper * str)
 StringSumHelper & operator + (const StringSumHelper &lhs, const String &rhs)
 {
 	StringSumHelper &a = const_cast<StringSumHelper&>(lhs);
-	if (!a.concat(rhs.buffer, rhs.len)) a.invalidate();
+	if (!a.concat(rhs.buffer(), rhs.len())) a.invalidate();
 	return a;
 }
 
@@ -433,24 +505,24 @@ StringSumHelper & operator + (const StringSumHelper &lhs, const __FlashStringHel
 
 int String::compareTo(const String &s) const
 {
-	if (!buffer || !s.buffer) {
-		if (s.buffer && s.len > 0) return 0 - *(unsigned char *)s.buffer;
-		if (buffer && len > 0) return *(unsigned char *)buffer;
+	if (!buffer() || !s.buffer()) {
+		if (s.buffer() && s.len() > 0) return 0 - *(unsigned char *)s.buffer();
+		if (buffer() && len() > 0) return *(unsigned char *)buffer();
 		return 0;
 	}
-	return strcmp(buffer, s.buffer);
+	return strcmp(buffer(), s.buffer());
 }
 
 unsigned char String::equals(const String &s2) const
 {
-	return (len == s2.len && compareTo(s2) == 0);
+	return (len() == s2.len() && compareTo(s2) == 0);
 }
 
 unsigned char String::equals(const char *cstr) const
 {
-	if (len == 0) return (cstr == NULL || *cstr == 0);
-	if (cstr == NULL) return buffer[0] == 0;
-	return strcmp(buffer, cstr) == 0;
+	if (len() == 0) return (cstr == NULL || *cstr == 0);
+	if (cstr == NULL) return buffer()[0] == 0;
+	return strcmp(buffer(), cstr) == 0;
 }
 
 unsigned char String::operator<(const String &rhs) const
@@ -476,10 +548,10 @@ unsigned char String::operator>=(const String &rhs) const
 unsigned char String::equalsIgnoreCase( const String &s2 ) const
 {
 	if (this == &s2) return 1;
-	if (len != s2.len) return 0;
-	if (len == 0) return 1;
-	const char *p1 = buffer;
-	const char *p2 = s2.buffer;
+	if (len() != s2.len()) return 0;
+	if (len() == 0) return 1;
+	const char *p1 = buffer();
+	const char *p2 = s2.buffer();
 	while (*p1) {
 		if (tolower(*p1++) != tolower(*p2++)) return 0;
 	} 
@@ -488,20 +560,20 @@ unsigned char String::equalsIgnoreCase( const String &s2 ) const
 
 unsigned char String::startsWith( const String &s2 ) const
 {
-	if (len < s2.len) return 0;
+	if (len() < s2.len()) return 0;
 	return startsWith(s2, 0);
 }
 
 unsigned char String::startsWith( const String &s2, unsigned int offset ) const
 {
-	if (offset > len - s2.len || !buffer || !s2.buffer) return 0;
-	return strncmp( &buffer[offset], s2.buffer, s2.len ) == 0;
+	if (offset > len() - s2.len() || !buffer() || !s2.buffer()) return 0;
+	return strncmp( &buffer()[offset], s2.buffer(), s2.len() ) == 0;
 }
 
 unsigned char String::endsWith( const String &s2 ) const
 {
-	if ( len < s2.len || !buffer || !s2.buffer) return 0;
-	return strcmp(&buffer[len - s2.len], s2.buffer) == 0;
+	if ( len() < s2.len() || !buffer() || !s2.buffer()) return 0;
+	return strcmp(&buffer()[len() - s2.len()], s2.buffer()) == 0;
 }
 
 /*********************************************/
@@ -515,35 +587,35 @@ char String::charAt(unsigned int loc) const
 
 void String::setCharAt(unsigned int loc, char c) 
 {
-	if (loc < len) buffer[loc] = c;
+	if (loc < len()) buffer()[loc] = c;
 }
 
 char & String::operator[](unsigned int index)
 {
 	static char dummy_writable_char;
-	if (index >= len || !buffer) {
+	if (index >= len() || !buffer()) {
 		dummy_writable_char = 0;
 		return dummy_writable_char;
 	}
-	return buffer[index];
+	return buffer()[index];
 }
 
 char String::operator[]( unsigned int index ) const
 {
-	if (index >= len || !buffer) return 0;
-	return buffer[index];
+	if (index >= len() || !buffer()) return 0;
+	return buffer()[index];
 }
 
 void String::getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index) const
 {
 	if (!bufsize || !buf) return;
-	if (index >= len) {
+	if (index >= len()) {
 		buf[0] = 0;
 		return;
 	}
 	unsigned int n = bufsize - 1;
-	if (n > len - index) n = len - index;
-	strncpy((char *)buf, buffer + index, n);
+	if (n > len() - index) n = len() - index;
+	strncpy((char *)buf, buffer() + index, n);
 	buf[n] = 0;
 }
 
@@ -558,10 +630,10 @@ int String::indexOf(char c) const
 
 int String::indexOf( char ch, unsigned int fromIndex ) const
 {
-	if (fromIndex >= len) return -1;
-	const char* temp = strchr(buffer + fromIndex, ch);
+	if (fromIndex >= len()) return -1;
+	const char* temp = strchr(buffer() + fromIndex, ch);
 	if (temp == NULL) return -1;
-	return temp - buffer;
+	return temp - buffer();
 }
 
 int String::indexOf(const String &s2) const
@@ -571,42 +643,46 @@ int String::indexOf(const String &s2) const
 
 int String::indexOf(const String &s2, unsigned int fromIndex) const
 {
-	if (fromIndex >= len) return -1;
-	const char *found = strstr(buffer + fromIndex, s2.buffer);
-	if (found == NULL) return -1;
-	return found - buffer;
+	if (fromIndex >= len()) return -1;
+	return StringFinder(s2).find(buffer(), len(), fromIndex);
+}
+
+int String::indexOf(const StringFinder &finder, unsigned int fromIndex) const
+{
+	if (fromIndex >= len()) return -1;
+	return finder.find(buffer(), len(), fromIndex);
 }
 
 int String::lastIndexOf( char theChar ) const
 {
-	return lastIndexOf(theChar, len - 1);
+	return lastIndexOf(theChar, len() - 1);
 }
 
 int String::lastIndexOf(char ch, unsigned int fromIndex) const
 {
-	if (fromIndex >= len) return -1;
-	char tempchar = buffer[fromIndex + 1];
-	buffer[fromIndex + 1] = '\0';
-	char* temp = strrchr( buffer, ch );
-	buffer[fromIndex + 1] = tempchar;
+	if (fromIndex >= len()) return -1;
+	char tempchar = buffer()[fromIndex + 1];
+	buffer()[fromIndex + 1] = '\0';
+	char* temp = strrchr( buffer(), ch );
+	buffer()[fromIndex + 1] = tempchar;
 	if (temp == NULL) return -1;
-	return temp - buffer;
+	return temp - buffer();
 }
 
 int String::lastIndexOf(const String &s2) const
 {
-	return lastIndexOf(s2, len - s2.len);
+	return lastIndexOf(s2, len() - s2.len());
 }
 
 int String::lastIndexOf(const String &s2, unsigned int fromIndex) const
 {
-  	if (s2.len == 0 || len == 0 || s2.len > len) return -1;
-	if (fromIndex >= len) fromIndex = len - 1;
+  	if (s2.len() == 0 || len() == 0 || s2.len() > len()) return -1;
+	if (fromIndex >= len()) fromIndex = len() - 1;
 	int found = -1;
-	for (char *p = buffer; p <= buffer + fromIndex; p++) {
-		p = strstr(p, s2.buffer);
+	for (char *p = buffer(); p <= buffer() + fromIndex; p++) {
+		p = strstr(p, s2.buffer());
 		if (!p) break;
-		if ((unsigned int)(p - buffer) <= fromIndex) found = p - buffer;
+		if ((unsigned int)(p - buffer()) <= fromIndex) found = p - buffer();
 	}
 	return found;
 }
@@ -619,12 +695,12 @@ String String::substring(unsigned int left, unsigned int right) const
 		left = temp;
 	}
 	String out;
-	if (left >= len) return out;
-	if (right > len) right = len;
-	char temp = buffer[right];  // save the replaced character
-	buffer[right] = '\0';	
-	out = buffer + left;  // pointer arithmetic
-	buffer[right] = temp;  //restore character
+	if (left >= len()) return out;
+	if (right > len()) right = len();
+	char temp = buffer()[right];  // save the replaced character
+	buffer()[right] = '\0';	
+	out = buffer() + left;  // pointer arithmetic
+	buffer()[right] = temp;  //restore character
 	return out;
 }
 
@@ -634,53 +710,87 @@ String String::substring(unsigned int left, unsigned int right) const
 
 void String::replace(char find, char replace)
 {
-	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
+	if (!buffer()) return;
+	for (char *p = buffer(); *p; p++) {
 		if (*p == find) *p = replace;
 	}
 }
 
 void String::replace(const String& find, const String& replace)
 {
-	if (len == 0 || find.len == 0) return;
-	int diff = replace.len - find.len;
-	char *readFrom = buffer;
-	char *foundAt;
-	if (diff == 0) {
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			memcpy(foundAt, replace.buffer, replace.len);
-			readFrom = foundAt + replace.len;
-		}
-	} else if (diff < 0) {
-		char *writeTo = buffer;
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			unsigned int n = foundAt - readFrom;
-			memcpy(writeTo, readFrom, n);
-			writeTo += n;
-			memcpy(writeTo, replace.buffer, replace.len);
-			writeTo += replace.len;
-			readFrom = foundAt + find.len;
-			len += diff;
-		}
-		strcpy(writeTo, readFrom);
-	} else {
-		unsigned int size = len; // compute size needed for result
-		while ((foundAt = strstr(readFrom, find.buffer)) != NULL) {
-			readFrom = foundAt + find.len;
+	replaceAll(find, replace);
+}
+
+unsigned int String::replaceAll(const String& find, const String& replace)
+{
+	if (len() == 0 || find.len() == 0) return 0;
+	// The text is rewritten in place, so it can't be an argument as well
+	if (&find == this || &replace == this) {
+		String copy(*this);
+		return replaceAll(&find == this ? copy : find, &replace == this ? copy : replace);
+	}
+
+	StringFinder finder(find);
+	int diff = replace.len() - find.len();
+	unsigned int size = len();
+	if (diff > 0) {
+		// compute size needed for result
+		for (int i = finder.find(buffer(), len()); i >= 0;
+		     i = finder.find(buffer(), len(), i + find.len())) {
 			size += diff;
 		}
-		if (size == len) return;
-		if (size > capacity && !changeBuffer(size)) return; // XXX: tell user!
-		int index = len - 1;
-		while (index >= 0 && (index = lastIndexOf(find, index)) >= 0) {
-			readFrom = buffer + index + find.len;
-			memmove(readFrom + diff, readFrom, len - (readFrom - buffer));
-			len += diff;
-			buffer[len] = 0;
-			memcpy(buffer + index, replace.buffer, replace.len);
-			index--;
-		}
+		if (size == len()) return 0;
+		if (size > capacity() && !changeBuffer(size)) return 0;
+	}
+
+	// Move the text to the end of the buffer when it grows, so the result
+	// can be written from the start without overwriting text that is yet
+	// to be read
+	unsigned int offset = size - len();
+	char *readFrom = buffer() + offset;
+	if (offset) memmove(readFrom, buffer(), len() + 1);
+	char *readEnd = buffer() + size;
+	char *writeTo = buffer();
+	unsigned int count = 0;
+	int i;
+	while ((i = finder.find(readFrom, readEnd - readFrom)) >= 0) {
+		memmove(writeTo, readFrom, i);
+		writeTo += i;
+		memcpy(writeTo, replace.buffer(), replace.len());
+		writeTo += replace.len();
+		readFrom += i + find.len();
+		count++;
 	}
+	unsigned int n = readEnd - readFrom;
+	memmove(writeTo, readFrom, n);
+	setLen(writeTo + n - buffer());
+	buffer()[len()] = 0;
+	return count;
+}
+
+unsigned int String::split(char separator, String parts[], unsigned int maxParts) const
+{
+	return split(StringFinder(&separator, 1), parts, maxParts);
+}
+
+unsigned int String::split(const String &separator, String parts[], unsigned int maxParts) const
+{
+	return split(StringFinder(separator), parts, maxParts);
+}
+
+unsigned int String::split(const StringFinder &separator, String parts[], unsigned int maxParts) const
+{
+	if (!buffer() || maxParts == 0) return 0;
+	unsigned int count = 0;
+	unsigned int start = 0;
+	while (count + 1 < maxParts && separator.length()) {
+		int i = separator.find(buffer(), len(), start);
+		if (i < 0) break;
+		parts[count++].copy(buffer() + start, i - start);
+		start = i + separator.length();
+	}
+	parts[count++].copy(buffer() + start, len() - start);
+	return count;
 }
 
 void String::remove(unsigned int index){
@@ -691,41 +801,41 @@ void String::remove(unsigned int index){
 }
 
 void String::remove(unsigned int index, unsigned int count){
-	if (index >= len) { return; }
+	if (index >= len()) { return; }
 	if (count <= 0) { return; }
-	if (count > len - index) { count = len - index; }
-	char *writeTo = buffer + index;
-	len = len - count;
-	strncpy(writeTo, buffer + index + count,len - index);
-	buffer[len] = 0;
+	if (count > len() - index) { count = len() - index; }
+	char *writeTo = buffer() + index;
+	setLen(len() - count);
+	strncpy(writeTo, buffer() + index + count,len() - index);
+	buffer()[len()] = 0;
 }
 
 void String::toLowerCase(void)
 {
-	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
+	if (!buffer()) return;
+	for (char *p = buffer(); *p; p++) {
 		*p = tolower(*p);
 	}
 }
 
 void String::toUpperCase(void)
 {
-	if (!buffer) return;
-	for (char *p = buffer; *p; p++) {
+	if (!buffer()) return;
+	for (char *p = buffer(); *p; p++) {
 		*p = toupper(*p);
 	}
 }
 
 void String::trim(void)
 {
-	if (!buffer || len == 0) return;
-	char *begin = buffer;
+	if (!buffer() || len() == 0) return;
+	char *begin = buffer();
 	while (isspace(*begin)) begin++;
-	char *end = buffer + len - 1;
+	char *end = buffer() + len() - 1;
 	while (isspace(*end) && end >= begin) end--;
-	len = end + 1 - begin;
-	if (begin > buffer) memcpy(buffer, begin, len);
-	buffer[len] = 0;
+	setLen(end + 1 - begin);
+	if (begin > buffer()) memcpy(buffer(), begin, len());
+	buffer()[len()] = 0;
 }
 
 /*********************************************/
@@ -734,7 +844,7 @@ void String::trim(void)
 
 long String::toInt(void) const
 {
-	if (buffer) return atol(buffer);
+	if (buffer()) return atol(buffer());
 	return 0;
 }
 
@@ -745,6 +855,55 @@ float String::toFloat(void) const
 
 double String::toDouble(void) const
 {
-	if (buffer) return atof(buffer);
+	if (buffer()) return atof(buffer());
 	return 0;
 }
+
+/*********************************************/
+/*  StringFinder                             */
+/*********************************************/
+
+StringFinder::StringFinder(const char *str, unsigned int length)
+{
+	pattern = str;
+	len = length;
+	init();
+}
+
+StringFinder::StringFinder(const String &str)
+{
+	pattern = str.c_str();
+	len = str.length();
+	init();
+}
+
+void StringFinder::init(void)
+{
+	// How far the pattern can move when the text character under its
+	// last position is c: the distance from the last occurrence of c in
+	// the pattern (not counting its last position) to the end. Entries
+	// shared by several characters keep the smallest distance.
+	unsigned char max = len > 255 ? 255 : len;
+	memset(skip, max, sizeof(skip));
+	for (unsigned int i = len > 255 ? len - 255 : 0; i + 1 < len; i++)
+		skip[(unsigned char)pattern[i] % SKIP_SIZE] = len - 1 - i;
+}
+
+int StringFinder::find(const char *text, unsigned int length, unsigned int fromIndex) const
+{
+	if (len > length || fromIndex > length - len) return -1;
+	if (len == 0) return fromIndex;
+	if (len == 1) {
+		const char *found = (const char *)memchr(text + fromIndex, pattern[0], length - fromIndex);
+		return found ? found - text : -1;
+	}
+
+	const char last = pattern[len - 1];
+	const char *end = text + length - len;
+	for (const char *p = text + fromIndex; p <= end;
+	     p += skip[(unsigned char)p[len - 1] % SKIP_SIZE]) {
+		if (p[len - 1] == last && memcmp(p, pattern, len - 1) == 0)
+			return p - text;
+	}
+	return -1;
+}
@@ -34,6 +34,15 @@
 //     -felide-constructors
 //     -std=c++0x
 
+// Strings up to STRING_SSO_SIZE - 1 characters long are stored inside
+// the String object itself, without allocating any memory. They share
+// the bytes of the heap pointer, capacity and length, so on AVR a String
+// takes STRING_SSO_SIZE + 1 bytes, but at least 7: 14 by default. It can
+// be set from 6 (the pointer, capacity and length only) to 32.
+#ifndef STRING_SSO_SIZE
+#define STRING_SSO_SIZE 13
+#endif
+
 class __FlashStringHelper;
 #define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
 
@@ -41,6 +50,9 @@ class __FlashStringHelper;
 // result objects are assumed to be writable by subsequent concatenations.
 class StringSumHelper;
 
+// Precomputed search for a substring, see below
+class StringFinder;
+
 // The string class
 class String
 {
@@ -78,7 +90,7 @@ public:
 	// is left unchanged).  reserve(0), if successful, will validate an
 	// invalid string (i.e., "if (s)" will be true afterwards)
 	unsigned char reserve(unsigned int size);
-	inline unsigned int length(void) const {return len;}
+	inline unsigned int length(void) const {return len();}
 
 	// creates a copy of the assigned value.  if the value is null or
 	// invalid, or if the memory allocation fails, the string will be
@@ -135,7 +147,7 @@ public:
 	friend StringSumHelper & operator + (const StringSumHelper &lhs, const __FlashStringHelper *rhs);
 
 	// comparison (only works w/ Strings and "strings")
-	operator StringIfHelperType() const { return buffer ? &String::StringIfHelper : 0; }
+	operator StringIfHelperType() const { return buffer() ? &String::StringIfHelper : 0; }
 	int compareTo(const String &s) const;
 	unsigned char equals(const String &s) const;
 	unsigned char equals(const char *cstr) const;
@@ -160,9 +172,9 @@ public:
 	void getBytes(unsigned char *buf, unsigned int bufsize, unsigned int index=0) const;
 	void toCharArray(char *buf, unsigned int bufsize, unsigned int index=0) const
 		{ getBytes((unsigned char *)buf, bufsize, index); }
-	const char* c_str() const { return buffer; }
-	char* begin() { return buffer; }
-	char* end() { return buffer + length(); }
+	const char* c_str() const { return buffer(); }
+	char* begin() { return buffer(); }
+	char* end() { return buffer() + length(); }
 	const char* begin() const { return c_str(); }
 	const char* end() const { return c_str() + length(); }
 
@@ -171,16 +183,24 @@ public:
 	int indexOf( char ch, unsigned int fromIndex ) const;
 	int indexOf( const String &str ) const;
 	int indexOf( const String &str, unsigned int fromIndex ) const;
+	int indexOf( const StringFinder &finder, unsigned int fromIndex = 0 ) const;
 	int lastIndexOf( char ch ) const;
 	int lastIndexOf( char ch, unsigned int fromIndex ) const;
 	int lastIndexOf( const String &str ) const;
 	int lastIndexOf( const String &str, unsigned int fromIndex ) const;
-	String substring( unsigned int beginIndex ) const { return substring(beginIndex, len); };
+	String substring( unsigned int beginIndex ) const { return substring(beginIndex, len()); };
 	String substring( unsigned int beginIndex, unsigned int endIndex ) const;
 
 	// modification
 	void replace(char find, char replace);
 	void replace(const String& find, const String& replace);
+	// like replace(), but returns the number of replacements made
+	unsigned int replaceAll(const String& find, const String& replace);
+	// stores the parts between separators in parts (at most maxParts, the
+	// last one gets the rest of the string), returns the number of parts
+	unsigned int split(char separator, String parts[], unsigned int maxParts) const;
+	unsigned int split(const String &separator, String parts[], unsigned int maxParts) const;
+	unsigned int split(const StringFinder &separator, String parts[], unsigned int maxParts) const;
 	void remove(unsigned int index);
 	void remove(unsigned int index, unsigned int count);
 	void toLowerCase(void);
@@ -193,13 +213,38 @@ public:
 	double toDouble(void) const;
 
 protected:
-	char *buffer;	        // the actual char array
-	unsigned int capacity;  // the array length minus one (for the '\0')
-	unsigned int len;       // the String length (not counting the '\0')
+	// Short strings are kept in sso, with their length in ssoLen.
+	// Longer ones are kept in a heap (or fixed) buffer described by ptr.
+	struct _ptr {
+		char *buff;        // the actual char array
+		unsigned int cap;  // the array length minus one (for the '\0')
+		unsigned int len;  // the String length (not counting the '\0')
+	};
+	union {
+		struct _ptr ptr;
+		char sso[STRING_SSO_SIZE];
+	};
+       #if __cplusplus >= 201103L || defined(__GXX_EXPERIMENTAL_CXX0X__)
+	static_assert(STRING_SSO_SIZE <= 32, "STRING_SSO_SIZE can be at most 32, ssoLen has 5 bits");
+	#endif
+	unsigned char ssoLen : 5;
+	unsigned char isInline : 1;   // the string is in sso, not in ptr.buff
+	unsigned char fixed : 1;      // ptr.buff is supplied by a derived class and can't grow
+	unsigned char overflowed : 1; // a fixed buffer was too small, see StaticString
 protected:
+	// the char array, NULL for an invalid string
+	char *buffer(void) const { return isInline ? const_cast<char *>(sso) : ptr.buff; }
+	unsigned int capacity(void) const { return isInline ? sizeof(sso) - 1 : ptr.cap; }
+	unsigned int len(void) const { return isInline ? ssoLen : ptr.len; }
+	void setLen(unsigned int length) { if (isInline) ssoLen = length; else ptr.len = length; }
+
+	// uses the given buffer of capacity + 1 bytes, which is never resized
+	// or freed (for StaticString)
+	String(char *fixedBuffer, unsigned int fixedCapacity);
 	void init(void);
 	void invalidate(void);
 	unsigned char changeBuffer(unsigned int maxStrLen);
+	unsigned char grow(unsigned int size);
 	unsigned char concat(const char *cstr, unsigned int length);
 
 	// copy and move
@@ -210,6 +255,32 @@ protected:
 	#endif
 };
 
+// Searches for a string using the Boyer-Moore-Horspool algorithm, which
+// skips ahead by up to the length of the string on a mismatch. The skip
+// table is built once, so a StringFinder can be reused for many
+// searches. The searched-for string must outlive the StringFinder.
+class StringFinder
+{
+public:
+	StringFinder(const char *str, unsigned int length);
+	StringFinder(const String &str);
+
+	// returns the index of the first match at or after fromIndex, or -1
+	int find(const char *text, unsigned int length, unsigned int fromIndex = 0) const;
+	int find(const String &text, unsigned int fromIndex = 0) const
+		{ return find(text.c_str(), text.length(), fromIndex); }
+	unsigned int length(void) const { return len; }
+
+private:
+	// characters share skip table entries by their low bits, to keep
+	// the table small
+	enum { SKIP_SIZE = 32 };
+	const char *pattern;
+	unsigned int len;
+	unsigned char skip[SKIP_SIZE];
+	void init(void);
+};
+
 class StringSumHelper : public String
 {
 public:
@@ -0,0 +1,146 @@
+/*
+  coroutine.c - Coroutines for Arduino
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#include "wiring_private.h"
+
+// This file is only linked in when the sketch uses startCoroutine(). The
+// default yield() (hooks.c) and main() call runCoroutines() if it is.
+
+// Unused stack bytes hold this, for coroutineStackUsed()
+#define STACK_FILL 0xa5
+
+// Bytes pushed by coroutine_switch() (coroutine.S), besides the return address
+#define SAVED_REGISTERS 18
+
+void coroutine_switch(void **save, void *sp);
+
+static Coroutine *first;  // started coroutines, in the order they run
+static Coroutine *current;  // the running coroutine, NULL for main()
+static void *mainSp;  // stack pointer of main() while a coroutine runs
+
+// Whether all coroutines waited in delay() when they last switched back,
+// and the earliest micros() at which one of them wakes up
+static bool allWaiting;
+static unsigned long wakeMicros;
+
+static void coroutineEntry(void)
+{
+	current->func();
+	current->func = NULL;
+	// Not resumed again, runCoroutines() removes it from the list
+	coroutine_switch(&current->sp, mainSp);
+}
+
+bool coroutineRunning(const Coroutine *co)
+{
+	Coroutine *c;
+	for (c = first; c; c = c->next)
+		if (c == co)
+			return co->func != NULL;
+	return false;
+}
+
+bool startCoroutine(Coroutine *co, void (*func)(void), void *stack, size_t stackSize)
+{
+	uint8_t *sp;
+	uint16_t pc = (uint16_t)coroutineEntry;  // a word address, like ret expects
+	Coroutine **last;
+
+	if (coroutineRunning(co) || stackSize < SAVED_REGISTERS + 3)
+		return false;
+
+	memset(stack, STACK_FILL, stackSize);
+
+	// Build the frame coroutine_switch() returns through. The stack
+	// pointer points at the next free byte, below what was pushed last.
+	sp = (uint8_t *)stack + stackSize - 1;
+	*sp-- = pc;
+	*sp-- = pc >> 8;
+#ifdef __AVR_3_BYTE_PC__
+	*sp-- = 0;
+#endif
+	sp -= SAVED_REGISTERS;
+
+	co->func = func;
+	co->sp = sp;
+	co->stack = (uint8_t *)stack;
+	co->stackSize = stackSize;
+	co->next = NULL;
+
+	for (last = &first; *last; last = &(*last)->next)
+		;
+	*last = co;
+	allWaiting = false;
+	return true;
+}
+
+size_t coroutineStackUsed(const Coroutine *co)
+{
+	size_t unused = 0;
+	while (unused < co->stackSize && co->stack[unused] == STACK_FILL)
+		unused++;
+	return co->stackSize - unused;
+}
+
+bool runCoroutines(void)
+{
+	Coroutine **link;
+
+	// Never switch stacks from an interrupt handler
+	if (bit_is_clear(SREG, SREG_I))
+		return !current;
+
+	if (current) {
+		coroutine_switch(&current->sp, mainSp);
+		return false;
+	}
+
+	allWaiting = true;
+	link = &first;
+	while (*link) {
+		current = *link;
+		delay_waiting = false;
+		coroutine_switch(&mainSp, current->sp);
+		if (current->func) {
+			// delay() sets delay_waiting before it yields
+			if (!delay_waiting)
+				allWaiting = false;
+			else if (link == &first || (long)(delay_wake - wakeMicros) < 0)
+				wakeMicros = delay_wake;
+			link = &current->next;
+		} else {
+			*link = current->next;
+		}
+	}
+	current = NULL;
+	return true;
+}
+
+unsigned long coroutinesIdleMicros(void)
+{
+	long wait;
+
+	if (!first)
+		return 0xffffffff;
+	if (current || !allWaiting)
+		return 0;
+	wait = wakeMicros - micros();
+	return wait > 0 ? wait : 0;
+}
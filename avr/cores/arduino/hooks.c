@@ -16,8 +16,17 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <stdbool.h>
+
+// The task scheduler (scheduler.cpp) and coroutines (coroutine.c), only
+// linked in when the sketch uses them
+extern void runTasks(void) __attribute__((weak));
+extern bool runCoroutines(void) __attribute__((weak));
+
 /**
- * Empty yield() hook.
+ * Default yield() hook, which switches between coroutines and runs the
+ * task scheduler, when they are used. Tasks only run from the sketch,
+ * not on the stack of a coroutine.
  *
  * This function is intended to be used by library writers to build
  * libraries or sketches that supports cooperative threads.
@@ -25,7 +34,8 @@
  * Its defined as a weak symbol and it can be redefined to implement a
  * real cooperative scheduler.
  */
-static void __empty() {
-	// Empty
+static void __yield() {
+	if (runCoroutines && !runCoroutines()) return;
+	if (runTasks) runTasks();
 }
-void yield(void) __attribute__ ((weak, alias("__empty")));
+void yield(void) __attribute__ ((weak, alias("__yield")));
@@ -30,6 +30,10 @@ void initVariant() { }
 void setupUSB() __attribute__((weak));
 void setupUSB() { }
 
+// Only linked in when the sketch schedules any tasks or coroutines
+extern void runTasks(void) __attribute__((weak));
+extern bool runCoroutines(void) __attribute__((weak));
+
 int main(void)
 {
 	init();
@@ -44,7 +48,12 @@ int main(void)
     
 	for (;;) {
 		loop();
-		if (serialEventRun) serialEventRun();
+		// runTasks() calls serialEventRun() itself
+		if (serialEventRun && !runTasks) serialEventRun();
+		if (runCoroutines) runCoroutines();
+		if (runTasks) runTasks();
+		// Unread data is likely for loop() to handle
+		if (!serialRxPending || !serialRxPending()) idle();
 	}
         
 	return 0;
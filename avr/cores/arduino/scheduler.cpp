@@ -0,0 +1,149 @@
+/*
+  scheduler.cpp - Cooperative task scheduler for Arduino
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Arduino.h"
+
+// This file is only linked in when the sketch uses scheduleTask(). The
+// default yield() (hooks.c) and main() call runTasks() if it is.
+
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 8
+#endif
+
+// The scheduled tasks, as a binary min-heap ordered by due time: the
+// task that is due first is always queue[0].
+static SchedulerTask *queue[SCHEDULER_MAX_TASKS];
+static uint8_t queueLength;
+static bool running;
+
+// true if a is due before b. Compares the difference, so this works
+// across the wrap-around of micros(), as long as due times are less
+// than 2^31 microseconds (35 minutes) apart.
+static inline bool earlier(const SchedulerTask *a, const SchedulerTask *b)
+{
+  return (long)(a->due - b->due) < 0;
+}
+
+static inline void place(uint8_t i, SchedulerTask *task)
+{
+  queue[i] = task;
+  task->slot = i + 1;
+}
+
+// Moves the task at index i up or down until the heap is in order again
+static void sift(uint8_t i)
+{
+  SchedulerTask *task = queue[i];
+
+  while (i > 0) {
+    uint8_t parent = (i - 1) / 2;
+    if (!earlier(task, queue[parent]))
+      break;
+    place(i, queue[parent]);
+    i = parent;
+  }
+
+  while (1) {
+    uint8_t child = 2 * i + 1;
+    if (child >= queueLength)
+      break;
+    if (child + 1 < queueLength && earlier(queue[child + 1], queue[child]))
+      child++;
+    if (!earlier(queue[child], task))
+      break;
+    place(i, queue[child]);
+    i = child;
+  }
+
+  place(i, task);
+}
+
+// The slot is checked against the queue, so a task that was never
+// scheduled doesn't need to be initialized
+bool taskScheduled(const SchedulerTask *task)
+{
+  return task->slot && task->slot <= queueLength && queue[task->slot - 1] == task;
+}
+
+void cancelTask(SchedulerTask *task)
+{
+  if (!taskScheduled(task))
+    return;
+
+  uint8_t i = task->slot - 1;
+  task->slot = 0;
+  SchedulerTask *last = queue[--queueLength];
+  if (i < queueLength) {
+    queue[i] = last;
+    sift(i);
+  }
+}
+
+bool scheduleTask(SchedulerTask *task, void (*callback)(void),
+                  unsigned long delayMicros, unsigned long intervalMicros)
+{
+  cancelTask(task);
+  if (queueLength >= SCHEDULER_MAX_TASKS)
+    return false;
+
+  task->callback = callback;
+  task->interval = intervalMicros;
+  task->due = micros() + delayMicros;
+  place(queueLength, task);
+  sift(queueLength++);
+  return true;
+}
+
+unsigned long tasksIdleMicros(void)
+{
+  if (!queueLength)
+    return 0xffffffff;
+  long wait = queue[0]->due - micros();
+  return wait > 0 ? wait : 0;
+}
+
+void runTasks(void)
+{
+  // Tasks that call yield() or delay() don't run other tasks from there
+  if (running)
+    return;
+  running = true;
+
+  if (queueLength) {
+    unsigned long now = micros();
+    while (queueLength && (long)(now - queue[0]->due) >= 0) {
+      SchedulerTask *task = queue[0];
+      if (task->interval) {
+        task->due += task->interval;
+        // Don't try to catch up on runs missed while the sketch blocked
+        if ((long)(now - task->due) >= 0)
+          task->due = now + task->interval;
+        sift(0);
+      } else {
+        cancelTask(task);
+      }
+      // Called last, so the callback can reschedule or cancel its task
+      task->callback();
+    }
+  }
+
+  // Serial events are handled while waiting as well
+  if (serialEventRun) serialEventRun();
+
+  running = false;
+}
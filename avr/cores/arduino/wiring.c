@@ -21,6 +21,7 @@
 */
 
 #include "wiring_private.h"
+#include <avr/sleep.h>
 
 // the prescaler is set so that timer0 ticks every 64 clock cycles, and the
 // the overflow handler is called every 256 ticks.
@@ -38,6 +39,9 @@
 volatile unsigned long timer0_overflow_count = 0;
 volatile unsigned long timer0_millis = 0;
 static unsigned char timer0_fract = 0;
+// bits 32-39 of the above, for the 64-bit clocks
+static volatile unsigned char timer0_overflow_count_hi = 0;
+static volatile unsigned char timer0_millis_hi = 0;
 
 #if defined(TIM0_OVF_vect)
 ISR(TIM0_OVF_vect)
@@ -45,21 +49,27 @@ ISR(TIM0_OVF_vect)
 ISR(TIMER0_OVF_vect)
 #endif
 {
-	// copy these to local variables so they can be stored in registers
-	// (volatile variables must be read from memory on every access)
-	unsigned long m = timer0_millis;
-	unsigned char f = timer0_fract;
-
-	m += MILLIS_INC;
-	f += FRACT_INC;
+	// The counters are updated a byte at a time, only touching the
+	// higher bytes on a carry. This keeps the number of registers used
+	// (and saved and restored on every overflow) low, compared to
+	// loading, adding and storing all 32 bits.
+	unsigned char f = timer0_fract + FRACT_INC;
+	unsigned char inc = MILLIS_INC;
 	if (f >= FRACT_MAX) {
 		f -= FRACT_MAX;
-		m += 1;
+		inc++;
 	}
-
 	timer0_fract = f;
-	timer0_millis = m;
-	timer0_overflow_count++;
+
+	volatile unsigned char *m = (volatile unsigned char *)&timer0_millis;
+	unsigned char b = m[0] + inc;
+	m[0] = b;
+	if (b < inc && ++m[1] == 0 && ++m[2] == 0 && ++m[3] == 0)
+		timer0_millis_hi++;
+
+	volatile unsigned char *c = (volatile unsigned char *)&timer0_overflow_count;
+	if (++c[0] == 0 && ++c[1] == 0 && ++c[2] == 0 && ++c[3] == 0)
+		timer0_overflow_count_hi++;
 }
 
 unsigned long millis()
@@ -76,43 +86,171 @@ unsigned long millis()
 	return m;
 }
 
-unsigned long micros() {
+uint64_t millis64()
+{
 	unsigned long m;
-	uint8_t oldSREG = SREG, t;
-	
+	unsigned char hi;
+	uint8_t oldSREG = SREG;
+
 	cli();
-	m = timer0_overflow_count;
+	m = timer0_millis;
+	hi = timer0_millis_hi;
+	SREG = oldSREG;
+
+	return ((uint64_t)hi << 32) | m;
+}
+
+// Reads the timer0 overflow count and TCNT0 as one consistent value,
+// without disabling interrupts: when the overflow interrupt changes the
+// count halfway, the values are just read again. An overflow that has
+// happened but not been counted yet (because interrupts are disabled)
+// is added, unless TCNT0 was read before it (so it reads 255).
+static unsigned long timer0_read(uint8_t *tcnt, unsigned char *hi)
+{
+	unsigned long m;
+	unsigned char h;
+	uint8_t t, pending;
+
+	do {
+		m = timer0_overflow_count;
+		h = timer0_overflow_count_hi;
 #if defined(TCNT0)
-	t = TCNT0;
+		t = TCNT0;
 #elif defined(TCNT0L)
-	t = TCNT0L;
+		t = TCNT0L;
 #else
-	#error TIMER 0 not defined
+		#error TIMER 0 not defined
 #endif
-
 #ifdef TIFR0
-	if ((TIFR0 & _BV(TOV0)) && (t < 255))
-		m++;
+		pending = (TIFR0 >> TOV0) & 1;
 #else
-	if ((TIFR & _BV(TOV0)) && (t < 255))
-		m++;
+		pending = (TIFR >> TOV0) & 1;
 #endif
+	} while (m != timer0_overflow_count);
+
+	// (t + 1) >> 8 is 1 only when t is 255
+	pending &= 1 ^ (uint8_t)(((uint16_t)t + 1) >> 8);
+	m += pending;
+	// carry into the high byte
+	h += pending & (m == 0);
+
+	*tcnt = t;
+	if (hi) *hi = h;
+	return m;
+}
+
+unsigned long micros() {
+	uint8_t t;
+	unsigned long m = timer0_read(&t, NULL);
 
-	SREG = oldSREG;
-	
 	return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond());
 }
 
+uint64_t micros64() {
+	uint8_t t;
+	unsigned char hi;
+	unsigned long m = timer0_read(&t, &hi);
+
+	return ((((uint64_t)hi << 32) | m) << 8 | t) * (64 / clockCyclesPerMicrosecond());
+}
+
+unsigned long ticks() {
+	uint8_t t;
+	unsigned long m = timer0_read(&t, NULL);
+
+	// timer0 counts once every 64 clock cycles
+	return ((m << 8) + t) << 6;
+}
+
+// Moves millis() and micros() forward by us microseconds, for time that
+// timer0 was stopped (see wiring_sleep.c). Returns the remainder that is
+// less than one overflow, which is not added.
+unsigned long timer0_advance(unsigned long us)
+{
+	unsigned long n = us / MICROSECONDS_PER_TIMER0_OVERFLOW;
+	unsigned long f, m, c;
+	uint8_t oldSREG = SREG;
+
+	cli();
+	f = timer0_fract + n * FRACT_INC;
+	m = timer0_millis;
+	timer0_millis = m + n * MILLIS_INC + f / FRACT_MAX;
+	if (timer0_millis < m)
+		timer0_millis_hi++;
+	timer0_fract = f % FRACT_MAX;
+	c = timer0_overflow_count;
+	timer0_overflow_count = c + n;
+	if (timer0_overflow_count < c)
+		timer0_overflow_count_hi++;
+	SREG = oldSREG;
+
+	return us - n * MICROSECONDS_PER_TIMER0_OVERFLOW;
+}
+
+static uint8_t idle_mode = IDLE_BUSY;
+
+bool delay_waiting;
+unsigned long delay_wake;
+
+// Only linked in when the sketch uses them (scheduler.cpp, coroutine.c)
+extern unsigned long tasksIdleMicros(void) __attribute__((weak));
+extern unsigned long coroutinesIdleMicros(void) __attribute__((weak));
+
+// Microseconds until a task or coroutine is due
+static unsigned long idle_micros(void)
+{
+	unsigned long wait = 0xffffffff, w;
+
+	if (tasksIdleMicros && (w = tasksIdleMicros()) < wait)
+		wait = w;
+	if (coroutinesIdleMicros && (w = coroutinesIdleMicros()) < wait)
+		wait = w;
+	return wait;
+}
+
+void setIdleMode(uint8_t mode)
+{
+	idle_mode = mode;
+}
+
+void idle(void)
+{
+	// With interrupts disabled, nothing would wake us up. The next
+	// timer0 overflow wakes us up at the latest, so only sleep when
+	// nothing is due before it.
+	if (idle_mode == IDLE_SLEEP && bit_is_set(SREG, SREG_I) &&
+	    idle_micros() > MICROSECONDS_PER_TIMER0_OVERFLOW) {
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_mode();
+	}
+}
+
+// Only linked in when the sketch calls setDelaySleepMode() (wiring_sleep.c)
+extern bool delaySleep(unsigned long ms) __attribute__((weak));
+
 void delay(unsigned long ms)
 {
 	uint32_t start = micros();
 
 	while (ms > 0) {
+		delay_wake = start + ms * 1000;
+		delay_waiting = true;
 		yield();
+		delay_waiting = false;
 		while ( ms > 0 && (micros() - start) >= 1000) {
 			ms--;
 			start += 1000;
 		}
+		// Only sleep when the next timer0 overflow (which wakes us up
+		// at the latest) is sure to come before the delay ends. Deeper
+		// sleep is cut short to the next task or coroutine that is due.
+		if (ms > MICROSECONDS_PER_TIMER0_OVERFLOW / 1000 + 1) {
+			unsigned long wait = idle_micros() / 1000;
+			if (wait > ms)
+				wait = ms;
+			if (!delaySleep || wait < 2 || !delaySleep(wait))
+				idle();
+		}
 	}
 }
 
@@ -238,6 +376,42 @@ void delayMicroseconds(unsigned int us)
 	// return = 4 cycles
 }
 
+static uint8_t timer_owners[6];
+
+// Claims a timer (0 to 5) for owner, or returns false if another owner has it
+bool timerClaim(uint8_t timer, uint8_t owner)
+{
+	bool claimed = false;
+	uint8_t oldSREG = SREG;
+
+	if (timer >= sizeof(timer_owners))
+		return false;
+	cli();
+	if (timer_owners[timer] == TIMER_FREE || timer_owners[timer] == owner) {
+		timer_owners[timer] = owner;
+		claimed = true;
+	}
+	SREG = oldSREG;
+	return claimed;
+}
+
+void timerRelease(uint8_t timer, uint8_t owner)
+{
+	uint8_t oldSREG = SREG;
+
+	if (timer >= sizeof(timer_owners))
+		return;
+	cli();
+	if (timer_owners[timer] == owner)
+		timer_owners[timer] = TIMER_FREE;
+	SREG = oldSREG;
+}
+
+uint8_t timerOwner(uint8_t timer)
+{
+	return timer < sizeof(timer_owners) ? timer_owners[timer] : TIMER_FREE;
+}
+
 void init()
 {
 	// this needs to be called before setup() or some functions won't
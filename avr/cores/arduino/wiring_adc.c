@@ -0,0 +1,244 @@
+/*
+  wiring_adc.c - Background ADC scanning
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// This file is only linked in when the sketch uses analogScanStart(), so
+// it only takes the ADC interrupt from sketches that use it.
+//
+// The ADC interrupt stores each result in a ring buffer, selects the
+// next pin in the list and starts its conversion. With a sample rate,
+// conversions are started by Timer1 instead (compare match B, in CTC
+// mode), which takes Timer1 away from PWM on its pins and from the Servo
+// library until analogScanStop(). It fails if another user has claimed
+// Timer1 (see timerClaim()). Don't use analogRead() meanwhile.
+//
+// Samples hold the value in the low 12 bits, and the position of the
+// pin in the list in the high 4.
+
+#include "wiring_private.h"
+
+#ifndef ANALOG_SCAN_BUFFER_SIZE
+#define ANALOG_SCAN_BUFFER_SIZE 32
+#endif
+#define ANALOG_SCAN_MAX_PINS 16
+
+#if (ANALOG_SCAN_BUFFER_SIZE & (ANALOG_SCAN_BUFFER_SIZE - 1)) || ANALOG_SCAN_BUFFER_SIZE > 256
+#error "ANALOG_SCAN_BUFFER_SIZE must be a power of 2, up to 256"
+#endif
+#define SCAN_MASK (ANALOG_SCAN_BUFFER_SIZE - 1)
+
+#if defined(ADCSRA) && defined(ADC)
+
+#if defined(ADCSRB) && defined(ADTS2) && defined(TCCR1B) && defined(OCR1B) && defined(WGM12)
+#define SCAN_TIMER1
+#endif
+
+static uint8_t scan_pins[ANALOG_SCAN_MAX_PINS];
+static uint8_t scan_count;
+static uint8_t scan_pos;  // position in scan_pins of the conversion running
+static volatile uint16_t scan_buffer[ANALOG_SCAN_BUFFER_SIZE];
+static volatile uint8_t scan_head;  // written by the interrupt only
+static volatile uint8_t scan_tail;  // written by analogScanRead() only
+static volatile uint16_t scan_dropped;
+
+#ifdef SCAN_TIMER1
+static bool scan_timed;
+static uint8_t saved_tccr1a, saved_tccr1b;
+static uint16_t saved_ocr1a, saved_ocr1b;
+#endif
+
+ISR(ADC_vect)
+{
+	uint16_t value = ADC;
+	uint8_t head = scan_head;
+	uint8_t next = (head + 1) & SCAN_MASK;
+
+	if (next != scan_tail) {
+		scan_buffer[head] = value | ((uint16_t)scan_pos << 12);
+		scan_head = next;
+	} else {
+		scan_dropped++;
+	}
+
+	if (++scan_pos == scan_count)
+		scan_pos = 0;
+	adc_select(scan_pins[scan_pos]);
+
+#ifdef SCAN_TIMER1
+	// The ADC starts on the rising edge of the compare flag, which
+	// has no interrupt of its own to clear it
+	if (scan_timed) {
+		TIFR1 = _BV(OCF1B);
+		return;
+	}
+#endif
+	sbi(ADCSRA, ADSC);
+}
+
+#ifdef SCAN_TIMER1
+static bool scan_timer_start(unsigned long sampleRate)
+{
+	static const uint16_t prescalers[] = { 1, 8, 64, 256, 1024 };
+	unsigned long top;
+	uint8_t cs;
+
+	for (cs = 0; cs < 5; cs++) {
+		top = F_CPU / prescalers[cs] / sampleRate;
+		if (top <= 65536UL)
+			break;
+	}
+	if (cs == 5 || top < 2)
+		return false;
+	if (!timerClaim(1, TIMER_OWNER_ADC))
+		return false;
+
+	saved_tccr1a = TCCR1A;
+	saved_tccr1b = TCCR1B;
+	saved_ocr1a = OCR1A;
+	saved_ocr1b = OCR1B;
+
+	// CTC mode with OCR1A as top, compare match B at the same count
+	TCCR1B = 0;
+	TCCR1A = 0;
+	TCNT1 = 0;
+	OCR1A = top - 1;
+	OCR1B = top - 1;
+	TIFR1 = _BV(OCF1B);
+	TCCR1B = _BV(WGM12) | (cs + 1);
+
+	// Auto trigger source: Timer/Counter1 compare match B
+	ADCSRB = (ADCSRB & ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0))) | _BV(ADTS2) | _BV(ADTS0);
+	scan_timed = true;
+	return true;
+}
+
+static void scan_timer_stop(void)
+{
+	ADCSRB &= ~(_BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0));
+	TCCR1B = 0;
+	TCCR1A = saved_tccr1a;
+	OCR1A = saved_ocr1a;
+	OCR1B = saved_ocr1b;
+	TCCR1B = saved_tccr1b;
+	scan_timed = false;
+	timerRelease(1, TIMER_OWNER_ADC);
+}
+#endif
+
+bool analogScanStart(const uint8_t *pins, uint8_t count, unsigned long sampleRate)
+{
+	if (count == 0 || count > ANALOG_SCAN_MAX_PINS)
+		return false;
+
+	analogScanStop();
+	memcpy(scan_pins, pins, count);
+	scan_count = count;
+	scan_pos = 0;
+	scan_head = 0;
+	scan_tail = 0;
+	scan_dropped = 0;
+	adc_select(scan_pins[0]);
+
+	if (sampleRate) {
+#ifdef SCAN_TIMER1
+		if (!scan_timer_start(sampleRate))
+			return false;
+		// writing ADIF clears it
+		ADCSRA |= _BV(ADIE) | _BV(ADIF) | _BV(ADATE);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	ADCSRA |= _BV(ADIE) | _BV(ADIF) | _BV(ADSC);
+	return true;
+}
+
+void analogScanStop(void)
+{
+	ADCSRA &= ~(_BV(ADIE) | _BV(ADATE));
+	while (bit_is_set(ADCSRA, ADSC))
+		;
+	// clear the flag of the last conversion
+	sbi(ADCSRA, ADIF);
+#ifdef SCAN_TIMER1
+	if (scan_timed)
+		scan_timer_stop();
+#endif
+}
+
+uint8_t analogScanAvailable(void)
+{
+	return (scan_head - scan_tail) & SCAN_MASK;
+}
+
+int analogScanRead(uint8_t *index)
+{
+	uint8_t tail = scan_tail;
+	uint16_t sample;
+
+	if (tail == scan_head)
+		return -1;
+
+	sample = scan_buffer[tail];
+	scan_tail = (tail + 1) & SCAN_MASK;
+	if (index)
+		*index = sample >> 12;
+	return sample & 0x0fff;
+}
+
+uint16_t analogScanDropped(void)
+{
+	uint16_t dropped;
+	uint8_t oldSREG = SREG;
+
+	cli();
+	dropped = scan_dropped;
+	SREG = oldSREG;
+	return dropped;
+}
+
+#else
+
+bool analogScanStart(const uint8_t *pins, uint8_t count, unsigned long sampleRate)
+{
+	return false;
+}
+
+void analogScanStop(void)
+{
+}
+
+uint8_t analogScanAvailable(void)
+{
+	return 0;
+}
+
+int analogScanRead(uint8_t *index)
+{
+	return -1;
+}
+
+uint16_t analogScanDropped(void)
+{
+	return 0;
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include "pins_arduino.h"
 
 uint8_t analog_reference = DEFAULT;
+static uint8_t analog_resolution = 10;
 
 void analogReference(uint8_t mode)
 {
@@ -35,9 +36,10 @@ void analogReference(uint8_t mode)
 	analog_reference = mode;
 }
 
-int analogRead(uint8_t pin)
+// Selects the ADC channel of an analog pin (or channel number), with the
+// analog reference, for the next conversion
+void adc_select(uint8_t pin)
 {
-
 #if defined(analogPinToChannel)
 #if defined(__AVR_ATmega32U4__)
 	if (pin >= 18) pin -= 18; // allow for channel or pin numbers
@@ -69,11 +71,41 @@ int analogRead(uint8_t pin)
 	ADMUX = (analog_reference << 6) | (pin & 0x07);
 #endif
 #endif
+}
 
-	// without a delay, we seem to read from the wrong channel
-	//delay(1);
+// Resolution of analogRead() in bits, from 1 to 14. Up to 8 bits, only
+// the high byte of the result is read (see ADLAR in the datasheet),
+// which pairs well with a faster analogReadSpeed(). Above 10 bits, each
+// read sums 4^n conversions and divides by 2^n to get n more bits. That
+// only works with some noise on the input, and takes 4 times longer per
+// extra bit.
+void analogReadResolution(uint8_t bits)
+{
+	if (bits < 1) bits = 1;
+	if (bits > 14) bits = 14;
+	analog_resolution = bits;
+}
+
+// Sets the ADC clock to the fastest the prescaler allows up to adcClock
+// (in Hz). The default is 125 kHz at 16 MHz. A conversion takes 13 ADC
+// clocks, so that is 9.6k samples per second, and 77k at 1 MHz. The ADC
+// is only accurate to 10 bits up to 200 kHz, at 1 MHz it still gives
+// about 8 bits.
+void analogReadSpeed(unsigned long adcClock)
+{
+#if defined(ADCSRA) && defined(ADPS0)
+	// the clock is F_CPU / 2^ADPS, where ADPS is 1 to 7
+	uint8_t ps = 1;
+	while (ps < 7 && (F_CPU >> ps) > adcClock)
+		ps++;
+	// don't write a one to ADIF, which would clear it
+	ADCSRA = (ADCSRA & ~(_BV(ADIF) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))) | ps;
+#endif
+}
 
 #if defined(ADCSRA) && defined(ADC)
+static uint16_t adc_convert(void)
+{
 	// start the conversion
 	sbi(ADCSRA, ADSC);
 
@@ -83,18 +115,243 @@ int analogRead(uint8_t pin)
 	// ADC macro takes care of reading ADC register.
 	// avr-gcc implements the proper reading order: ADCL is read first.
 	return ADC;
+}
+#endif
+
+int analogRead(uint8_t pin)
+{
+	adc_select(pin);
+
+	// without a delay, we seem to read from the wrong channel
+	//delay(1);
+
+#if defined(ADCSRA) && defined(ADC)
+	uint8_t bits = analog_resolution;
+
+#if defined(ADLAR)
+	if (bits <= 8) {
+		sbi(ADMUX, ADLAR);
+		sbi(ADCSRA, ADSC);
+		while (bit_is_set(ADCSRA, ADSC));
+		return ADCH >> (8 - bits);
+	}
+#endif
+
+	if (bits <= 10)
+		return adc_convert() >> (10 - bits);
+
+	uint8_t extra = bits - 10;
+	uint16_t n = (uint16_t)1 << (2 * extra);
+	uint32_t sum = 0;
+	do {
+		sum += adc_convert();
+	} while (--n);
+	return sum >> extra;
 #else
 	// we dont have an ADC, return 0
 	return 0;
 #endif
 }
 
+#if defined(ADCSRA) && defined(ADC)
+static bool analog_pending = false;
+#endif
+
+bool analogReadAsync(uint8_t pin)
+{
+#if defined(ADCSRA) && defined(ADC)
+	// busy with another conversion, or the scanner (wiring_adc.c) runs
+	if (bit_is_set(ADCSRA, ADSC) || bit_is_set(ADCSRA, ADIE))
+		return false;
+
+	adc_select(pin);
+	sbi(ADCSRA, ADSC);
+	analog_pending = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+int analogReadResult(void)
+{
+#if defined(ADCSRA) && defined(ADC)
+	if (!analog_pending || bit_is_set(ADCSRA, ADSC))
+		return -1;
+
+	analog_pending = false;
+	return ADC;
+#else
+	return -1;
+#endif
+}
+
+// Fills in the registers of a PWM timer channel (one of the TIMER*
+// values from digitalPinToTimer()), or returns false for NOT_ON_TIMER
+// and channels this chip doesn't have.
+#define PWM_CHANNEL(tccr, on, off, ocrn) \
+	ch->com = &(tccr); \
+	ch->comSet = _BV(on); \
+	ch->comClear = (off); \
+	ch->ocr = (volatile uint8_t *)&(ocrn); \
+	ch->wide = sizeof(ocrn) == 2
+
+bool pwm_channel(uint8_t timer, pwm_channel_t *ch)
+{
+	switch (timer)
+	{
+		// XXX fix needed for atmega8
+		#if defined(TCCR0) && defined(COM00) && !defined(__AVR_ATmega8__)
+		case TIMER0A:
+			PWM_CHANNEL(TCCR0, COM00, 0, OCR0);
+			return true;
+		#endif
+
+		#if defined(TCCR0A) && defined(COM0A1)
+		case TIMER0A:
+			PWM_CHANNEL(TCCR0A, COM0A1, 0, OCR0A);
+			return true;
+		#endif
+
+		#if defined(TCCR0A) && defined(COM0B1)
+		case TIMER0B:
+			PWM_CHANNEL(TCCR0A, COM0B1, 0, OCR0B);
+			return true;
+		#endif
+
+		#if defined(TCCR1A) && defined(COM1A1)
+		case TIMER1A:
+			PWM_CHANNEL(TCCR1A, COM1A1, 0, OCR1A);
+			return true;
+		#endif
+
+		#if defined(TCCR1A) && defined(COM1B1)
+		case TIMER1B:
+			PWM_CHANNEL(TCCR1A, COM1B1, 0, OCR1B);
+			return true;
+		#endif
+
+		#if defined(TCCR1A) && defined(COM1C1)
+		case TIMER1C:
+			PWM_CHANNEL(TCCR1A, COM1C1, 0, OCR1C);
+			return true;
+		#endif
+
+		#if defined(TCCR2) && defined(COM21)
+		case TIMER2:
+			PWM_CHANNEL(TCCR2, COM21, 0, OCR2);
+			return true;
+		#endif
+
+		#if defined(TCCR2A) && defined(COM2A1)
+		case TIMER2A:
+			PWM_CHANNEL(TCCR2A, COM2A1, 0, OCR2A);
+			return true;
+		#endif
+
+		#if defined(TCCR2A) && defined(COM2B1)
+		case TIMER2B:
+			PWM_CHANNEL(TCCR2A, COM2B1, 0, OCR2B);
+			return true;
+		#endif
+
+		#if defined(TCCR3A) && defined(COM3A1)
+		case TIMER3A:
+			PWM_CHANNEL(TCCR3A, COM3A1, 0, OCR3A);
+			return true;
+		#endif
+
+		#if defined(TCCR3A) && defined(COM3B1)
+		case TIMER3B:
+			PWM_CHANNEL(TCCR3A, COM3B1, 0, OCR3B);
+			return true;
+		#endif
+
+		#if defined(TCCR3A) && defined(COM3C1)
+		case TIMER3C:
+			PWM_CHANNEL(TCCR3A, COM3C1, 0, OCR3C);
+			return true;
+		#endif
+
+		#if defined(TCCR4A)
+		case TIMER4A:
+			#if defined(COM4A0)		// only used on 32U4
+			PWM_CHANNEL(TCCR4A, COM4A1, _BV(COM4A0), OCR4A);
+			#else
+			PWM_CHANNEL(TCCR4A, COM4A1, 0, OCR4A);
+			#endif
+			return true;
+		#endif
+
+		#if defined(TCCR4A) && defined(COM4B1)
+		case TIMER4B:
+			PWM_CHANNEL(TCCR4A, COM4B1, 0, OCR4B);
+			return true;
+		#endif
+
+		#if defined(TCCR4A) && defined(COM4C1)
+		case TIMER4C:
+			PWM_CHANNEL(TCCR4A, COM4C1, 0, OCR4C);
+			return true;
+		#endif
+
+		#if defined(TCCR4C) && defined(COM4D1)
+		case TIMER4D:
+			#if defined(COM4D0)		// only used on 32U4
+			PWM_CHANNEL(TCCR4C, COM4D1, _BV(COM4D0), OCR4D);
+			#else
+			PWM_CHANNEL(TCCR4C, COM4D1, 0, OCR4D);
+			#endif
+			return true;
+		#endif
+
+		#if defined(TCCR5A) && defined(COM5A1)
+		case TIMER5A:
+			PWM_CHANNEL(TCCR5A, COM5A1, 0, OCR5A);
+			return true;
+		#endif
+
+		#if defined(TCCR5A) && defined(COM5B1)
+		case TIMER5B:
+			PWM_CHANNEL(TCCR5A, COM5B1, 0, OCR5B);
+			return true;
+		#endif
+
+		#if defined(TCCR5A) && defined(COM5C1)
+		case TIMER5C:
+			PWM_CHANNEL(TCCR5A, COM5C1, 0, OCR5C);
+			return true;
+		#endif
+
+		case NOT_ON_TIMER:
+		default:
+			return false;
+	}
+}
+
+// Connects the pin to the PWM output of its channel
+static void pwm_connect(const pwm_channel_t *ch)
+{
+	*ch->com = (*ch->com & ~ch->comClear) | ch->comSet;
+}
+
+static void pwm_write(const pwm_channel_t *ch, uint8_t val)
+{
+	// a 16-bit write stores the high byte first, as the timer needs
+	if (ch->wide)
+		*(volatile uint16_t *)ch->ocr = val;
+	else
+		*ch->ocr = val;
+}
+
 // Right now, PWM output only works on the pins with
 // hardware support.  These are defined in the appropriate
 // pins_*.c file.  For the rest of the pins, we default
 // to digital output.
 void analogWrite(uint8_t pin, int val)
 {
+	pwm_channel_t ch;
+
 	// We need to make sure the PWM output is enabled for those pins
 	// that support it, as we turn it off when digitally reading or
 	// writing with them.  Also, make sure the pin is in output mode
@@ -109,178 +366,50 @@ void analogWrite(uint8_t pin, int val)
 	{
 		digitalWrite(pin, HIGH);
 	}
+	else if (pwm_channel(digitalPinToTimer(pin), &ch))
+	{
+		pwm_connect(&ch);
+		pwm_write(&ch, val); // set pwm duty
+	}
+	else if (val < 128)
+	{
+		digitalWrite(pin, LOW);
+	}
 	else
 	{
-		switch(digitalPinToTimer(pin))
-		{
-			// XXX fix needed for atmega8
-			#if defined(TCCR0) && defined(COM00) && !defined(__AVR_ATmega8__)
-			case TIMER0A:
-				// connect pwm to pin on timer 0
-				sbi(TCCR0, COM00);
-				OCR0 = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR0A) && defined(COM0A1)
-			case TIMER0A:
-				// connect pwm to pin on timer 0, channel A
-				sbi(TCCR0A, COM0A1);
-				OCR0A = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR0A) && defined(COM0B1)
-			case TIMER0B:
-				// connect pwm to pin on timer 0, channel B
-				sbi(TCCR0A, COM0B1);
-				OCR0B = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR1A) && defined(COM1A1)
-			case TIMER1A:
-				// connect pwm to pin on timer 1, channel A
-				sbi(TCCR1A, COM1A1);
-				OCR1A = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR1A) && defined(COM1B1)
-			case TIMER1B:
-				// connect pwm to pin on timer 1, channel B
-				sbi(TCCR1A, COM1B1);
-				OCR1B = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR1A) && defined(COM1C1)
-			case TIMER1C:
-				// connect pwm to pin on timer 1, channel C
-				sbi(TCCR1A, COM1C1);
-				OCR1C = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR2) && defined(COM21)
-			case TIMER2:
-				// connect pwm to pin on timer 2
-				sbi(TCCR2, COM21);
-				OCR2 = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR2A) && defined(COM2A1)
-			case TIMER2A:
-				// connect pwm to pin on timer 2, channel A
-				sbi(TCCR2A, COM2A1);
-				OCR2A = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR2A) && defined(COM2B1)
-			case TIMER2B:
-				// connect pwm to pin on timer 2, channel B
-				sbi(TCCR2A, COM2B1);
-				OCR2B = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR3A) && defined(COM3A1)
-			case TIMER3A:
-				// connect pwm to pin on timer 3, channel A
-				sbi(TCCR3A, COM3A1);
-				OCR3A = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR3A) && defined(COM3B1)
-			case TIMER3B:
-				// connect pwm to pin on timer 3, channel B
-				sbi(TCCR3A, COM3B1);
-				OCR3B = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR3A) && defined(COM3C1)
-			case TIMER3C:
-				// connect pwm to pin on timer 3, channel C
-				sbi(TCCR3A, COM3C1);
-				OCR3C = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR4A)
-			case TIMER4A:
-				//connect pwm to pin on timer 4, channel A
-				sbi(TCCR4A, COM4A1);
-				#if defined(COM4A0)		// only used on 32U4
-				cbi(TCCR4A, COM4A0);
-				#endif
-				OCR4A = val;	// set pwm duty
-				break;
-			#endif
-			
-			#if defined(TCCR4A) && defined(COM4B1)
-			case TIMER4B:
-				// connect pwm to pin on timer 4, channel B
-				sbi(TCCR4A, COM4B1);
-				OCR4B = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR4A) && defined(COM4C1)
-			case TIMER4C:
-				// connect pwm to pin on timer 4, channel C
-				sbi(TCCR4A, COM4C1);
-				OCR4C = val; // set pwm duty
-				break;
-			#endif
-				
-			#if defined(TCCR4C) && defined(COM4D1)
-			case TIMER4D:				
-				// connect pwm to pin on timer 4, channel D
-				sbi(TCCR4C, COM4D1);
-				#if defined(COM4D0)		// only used on 32U4
-				cbi(TCCR4C, COM4D0);
-				#endif
-				OCR4D = val;	// set pwm duty
-				break;
-			#endif
-
-							
-			#if defined(TCCR5A) && defined(COM5A1)
-			case TIMER5A:
-				// connect pwm to pin on timer 5, channel A
-				sbi(TCCR5A, COM5A1);
-				OCR5A = val; // set pwm duty
-				break;
-			#endif
-
-			#if defined(TCCR5A) && defined(COM5B1)
-			case TIMER5B:
-				// connect pwm to pin on timer 5, channel B
-				sbi(TCCR5A, COM5B1);
-				OCR5B = val; // set pwm duty
-				break;
-			#endif
+		digitalWrite(pin, HIGH);
+	}
+}
 
-			#if defined(TCCR5A) && defined(COM5C1)
-			case TIMER5C:
-				// connect pwm to pin on timer 5, channel C
-				sbi(TCCR5A, COM5C1);
-				OCR5C = val; // set pwm duty
-				break;
-			#endif
+#ifndef ANALOG_WRITE_FAST_CACHE
+#define ANALOG_WRITE_FAST_CACHE 4
+#endif
 
-			case NOT_ON_TIMER:
-			default:
-				if (val < 128) {
-					digitalWrite(pin, LOW);
-				} else {
-					digitalWrite(pin, HIGH);
-				}
+// Channels of the pins analogWriteFast() used last, at pin % size
+static struct {
+	uint8_t tag;  // pin + 1, 0 when empty
+	pwm_channel_t ch;
+} fast_cache[ANALOG_WRITE_FAST_CACHE];
+
+// analogWrite() that only looks up the pin the first time. After that,
+// as long as the pin stays connected to PWM, it is a single store to the
+// compare register. Unlike analogWrite(), 0 and 255 don't turn PWM off,
+// which on timer0 leaves a short pulse at 0.
+void analogWriteFast(uint8_t pin, uint8_t val)
+{
+	uint8_t slot = pin % ANALOG_WRITE_FAST_CACHE;
+	pwm_channel_t *ch = &fast_cache[slot].ch;
+
+	// digitalWrite() disconnects PWM, and analogWrite(0 or 255) too
+	if (fast_cache[slot].tag != pin + 1 || !(*ch->com & ch->comSet)) {
+		if (!pwm_channel(digitalPinToTimer(pin), ch)) {
+			fast_cache[slot].tag = 0;
+			analogWrite(pin, val);
+			return;
 		}
+		pinMode(pin, OUTPUT);
+		pwm_connect(ch);
+		fast_cache[slot].tag = pin + 1;
 	}
+	pwm_write(ch, val);
 }
-
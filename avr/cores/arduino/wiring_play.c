@@ -0,0 +1,296 @@
+/*
+  wiring_play.c - Playing samples on a PWM pin
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// This file is only linked in when the sketch uses analogPlayStart(), so
+// it only takes the timer overflow interrupts from sketches that use it.
+//
+// The timer of the pin runs in 8-bit fast PWM without a prescaler (62.5
+// kHz at 16 MHz), which also changes the frequency of analogWrite() on
+// the other pins of that timer. Its overflow interrupt stores the next
+// sample in the compare register every few PWM periods, and the timer
+// takes it at the start of the next period. Timer0 keeps millis() and
+// can't be used, and only one pin plays at a time.
+//
+// Samples come from two buffers in turn: while one plays, the sketch
+// fills the other and queues it with analogPlayQueue().
+
+#include "wiring_private.h"
+
+#if defined(TIMSK1) && defined(TOIE1) && defined(WGM12)
+
+#if defined(TCCR2A) && defined(TIMSK2) && defined(TOIE2)
+#define PLAY_TIMER2
+#endif
+#if defined(TCCR3A) && defined(TIMSK3) && defined(WGM32)
+#define PLAY_TIMER3
+#endif
+// not the 10-bit timer4 of the 32U4
+#if defined(TCCR4A) && defined(TIMSK4) && defined(WGM42)
+#define PLAY_TIMER4
+#endif
+#if defined(TCCR5A) && defined(TIMSK5) && defined(WGM52)
+#define PLAY_TIMER5
+#endif
+
+static pwm_channel_t play_ch;  // play_ch.ocr is NULL when stopped
+static volatile uint8_t *play_tccra, *play_tccrb, *play_timsk;
+static uint8_t play_toie;
+static uint8_t play_timer;  // number, for timerRelease()
+static uint8_t saved_tccra, saved_tccrb;
+
+static uint8_t play_divider;  // PWM periods per sample
+static uint8_t play_count;
+static const uint8_t *play_pos, *play_end;  // used by the interrupt only
+static const uint8_t * volatile play_next;  // queued buffer, NULL if none
+static size_t play_next_count;
+static bool play_underrun;
+static void (*volatile play_underrun_callback)(void);
+
+ISR(TIMER1_OVF_vect)
+{
+	const uint8_t *pos;
+
+	if (--play_count)
+		return;
+	play_count = play_divider;
+
+	pos = play_pos;
+	if (pos == play_end) {
+		if (!play_next) {
+			// keep the last sample until there are new ones
+			if (!play_underrun) {
+				play_underrun = true;
+				if (play_underrun_callback)
+					play_underrun_callback();
+			}
+			return;
+		}
+		pos = play_next;
+		play_end = pos + play_next_count;
+		play_next = NULL;
+		play_underrun = false;
+	}
+
+	if (play_ch.wide)
+		*(volatile uint16_t *)play_ch.ocr = *pos++;
+	else
+		*play_ch.ocr = *pos++;
+	play_pos = pos;
+}
+
+#ifdef PLAY_TIMER2
+ISR(TIMER2_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
+#endif
+#ifdef PLAY_TIMER3
+ISR(TIMER3_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
+#endif
+#ifdef PLAY_TIMER4
+ISR(TIMER4_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
+#endif
+#ifdef PLAY_TIMER5
+ISR(TIMER5_OVF_vect, ISR_ALIASOF(TIMER1_OVF_vect));
+#endif
+
+// Plays the queued samples on pin at (about) sampleRate samples per
+// second. That is F_CPU / 256 divided by a whole number from 1 to 255:
+// from 245 Hz to 62.5 kHz at 16 MHz. Returns false if the pin is not on
+// one of timers 1 to 5, the timer is used by something else (see
+// timerClaim()), or the rate is out of range.
+bool analogPlayStart(uint8_t pin, unsigned long sampleRate)
+{
+	uint8_t timer = digitalPinToTimer(pin);
+	unsigned long divider;
+	uint8_t wgma, tccrb;
+
+	if (!sampleRate)
+		return false;
+	divider = (F_CPU / 256 + sampleRate / 2) / sampleRate;
+	if (divider < 1 || divider > 255)
+		return false;
+
+	analogPlayStop();
+
+	// fast PWM with 0xff as top, no prescaler
+	switch (timer) {
+	case TIMER1A:
+	case TIMER1B:
+	case TIMER1C:
+		play_tccra = &TCCR1A;
+		play_tccrb = &TCCR1B;
+		play_timsk = &TIMSK1;
+		play_toie = _BV(TOIE1);
+		wgma = _BV(WGM10);
+		tccrb = _BV(WGM12) | _BV(CS10);
+		break;
+#ifdef PLAY_TIMER2
+	case TIMER2A:
+	case TIMER2B:
+		play_tccra = &TCCR2A;
+		play_tccrb = &TCCR2B;
+		play_timsk = &TIMSK2;
+		play_toie = _BV(TOIE2);
+		wgma = _BV(WGM21) | _BV(WGM20);
+		tccrb = _BV(CS20);
+		break;
+#endif
+#ifdef PLAY_TIMER3
+	case TIMER3A:
+	case TIMER3B:
+	case TIMER3C:
+		play_tccra = &TCCR3A;
+		play_tccrb = &TCCR3B;
+		play_timsk = &TIMSK3;
+		play_toie = _BV(TOIE3);
+		wgma = _BV(WGM30);
+		tccrb = _BV(WGM32) | _BV(CS30);
+		break;
+#endif
+#ifdef PLAY_TIMER4
+	case TIMER4A:
+	case TIMER4B:
+	case TIMER4C:
+		play_tccra = &TCCR4A;
+		play_tccrb = &TCCR4B;
+		play_timsk = &TIMSK4;
+		play_toie = _BV(TOIE4);
+		wgma = _BV(WGM40);
+		tccrb = _BV(WGM42) | _BV(CS40);
+		break;
+#endif
+#ifdef PLAY_TIMER5
+	case TIMER5A:
+	case TIMER5B:
+	case TIMER5C:
+		play_tccra = &TCCR5A;
+		play_tccrb = &TCCR5B;
+		play_timsk = &TIMSK5;
+		play_toie = _BV(TOIE5);
+		wgma = _BV(WGM50);
+		tccrb = _BV(WGM52) | _BV(CS50);
+		break;
+#endif
+	default:
+		return false;
+	}
+	play_timer = pwm_timer_number(timer);
+	if (!timerClaim(play_timer, TIMER_OWNER_PLAY))
+		return false;
+	if (!pwm_channel(timer, &play_ch)) {
+		timerRelease(play_timer, TIMER_OWNER_PLAY);
+		return false;
+	}
+
+	play_divider = divider;
+	play_count = divider;
+	play_pos = play_end = NULL;
+	play_next = NULL;
+	play_underrun = true;  // no callback before the first buffer
+
+	pinMode(pin, OUTPUT);
+	saved_tccra = *play_tccra;
+	saved_tccrb = *play_tccrb;
+	// the WGM bits are the low two of TCCRnA on all of these timers
+	*play_tccrb = 0;
+	*play_tccra = (saved_tccra & ~(play_ch.comClear | 0x03)) | play_ch.comSet | wgma;
+	*play_tccrb = tccrb;
+	*play_timsk |= play_toie;
+	return true;
+}
+
+// Stops playing and puts the timer back the way it was
+void analogPlayStop(void)
+{
+	if (!play_ch.ocr)
+		return;
+	*play_timsk &= ~play_toie;
+	*play_tccrb = 0;
+	*play_tccra = saved_tccra;
+	*play_tccrb = saved_tccrb;
+	play_ch.ocr = NULL;
+	timerRelease(play_timer, TIMER_OWNER_PLAY);
+}
+
+// Queues count samples to play after the current ones. The buffer must
+// stay as it is until it has played. Returns false if another buffer is
+// still waiting.
+bool analogPlayQueue(const uint8_t *samples, size_t count)
+{
+	bool queued = false;
+	uint8_t oldSREG = SREG;
+
+	if (!play_ch.ocr || !count)
+		return false;
+
+	cli();
+	if (!play_next) {
+		play_next = samples;
+		play_next_count = count;
+		queued = true;
+	}
+	SREG = oldSREG;
+	return queued;
+}
+
+// true when no buffer is waiting, so the one queued before the buffer
+// that plays now is done and can be filled again
+bool analogPlayReady(void)
+{
+	bool ready;
+	uint8_t oldSREG = SREG;
+
+	cli();
+	ready = !play_next;
+	SREG = oldSREG;
+	return ready;
+}
+
+// Calls callback from the interrupt when all queued samples have played.
+// The pin keeps the last sample until another buffer is queued.
+void analogPlayOnUnderrun(void (*callback)(void))
+{
+	play_underrun_callback = callback;
+}
+
+#else
+
+bool analogPlayStart(uint8_t pin, unsigned long sampleRate)
+{
+	return false;
+}
+
+void analogPlayStop(void)
+{
+}
+
+bool analogPlayQueue(const uint8_t *samples, size_t count)
+{
+	return false;
+}
+
+bool analogPlayReady(void)
+{
+	return true;
+}
+
+void analogPlayOnUnderrun(void (*callback)(void))
+{
+}
+
+#endif
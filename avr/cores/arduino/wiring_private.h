@@ -41,6 +41,36 @@ extern "C"{
 #define sbi(sfr, bit) (_SFR_BYTE(sfr) |= _BV(bit))
 #endif
 
+unsigned long timer0_advance(unsigned long us);
+
+// Set by delay() while it yields, with the micros() at which it ends, so
+// runCoroutines() knows a coroutine only waits (see coroutine.c)
+extern bool delay_waiting;
+extern unsigned long delay_wake;
+void adc_select(uint8_t pin);
+
+// The registers of a PWM timer channel
+typedef struct {
+	volatile uint8_t *com;  // register with the compare output mode bits
+	uint8_t comSet;  // bit that connects the pin
+	uint8_t comClear;  // bits that must be cleared along with it
+	volatile uint8_t *ocr;  // compare register, the low byte if wide
+	bool wide;  // 16 bits
+} pwm_channel_t;
+
+bool pwm_channel(uint8_t timer, pwm_channel_t *ch);
+
+// The number of the timer (0 to 5) of a TIMER* channel
+static inline uint8_t pwm_timer_number(uint8_t timer)
+{
+	if (timer >= TIMER5A) return 5;
+	if (timer >= TIMER4A) return 4;
+	if (timer >= TIMER3A) return 3;
+	if (timer >= TIMER2) return 2;
+	if (timer >= TIMER1A) return 1;
+	return 0;
+}
+
 uint32_t countPulseASM(volatile uint8_t *port, uint8_t bit, uint8_t stateMask, unsigned long maxloops);
 
 #define EXTERNAL_INT_0 0
@@ -64,6 +94,7 @@ uint32_t countPulseASM(volatile uint8_t *port, uint8_t bit, uint8_t stateMask, u
 #endif
 
 typedef void (*voidFuncPtr)(void);
+typedef void (*voidFuncPtrParam)(void *);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,173 @@
+/*
+  wiring_pwm.c - High resolution PWM on the 16-bit timers
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// init() runs Timer1, 3, 4 and 5 in 8-bit phase correct PWM at about
+// 490 Hz. analogWrite16() and analogWriteFrequency() switch the timer of
+// the pin to fast PWM with ICRn as top, and the resolution follows from
+// the frequency: 16 bits up to 244 Hz at 16 MHz, 10 bits at 15.6 kHz and
+// 800 steps at 20 kHz. This applies to all pins of the timer, so use
+// analogWrite16() rather than analogWrite() on the others. Timer0 keeps
+// millis() and Timer2 has only 8 bits, so they are left alone.
+//
+// The timer is claimed for TIMER_OWNER_PWM until analogWriteFrequency()
+// is called with 0, which puts it back the way it was.
+
+#include "wiring_private.h"
+
+typedef struct {
+	volatile uint8_t *tccra;
+	volatile uint8_t *tccrb;
+	volatile uint16_t *icr;
+	volatile uint16_t *tcnt;
+} timer16_t;
+
+static uint8_t saved_tccra[6], saved_tccrb[6];
+
+// Fills in the registers of the timer of a TIMER* channel, or returns
+// false if it is not a 16-bit timer with an ICR register
+static bool timer16(uint8_t timer, timer16_t *t)
+{
+	switch (pwm_timer_number(timer)) {
+#if defined(TCCR1A) && defined(ICR1) && defined(WGM13)
+	case 1:
+		t->tccra = &TCCR1A;
+		t->tccrb = &TCCR1B;
+		t->icr = &ICR1;
+		t->tcnt = &TCNT1;
+		return true;
+#endif
+#if defined(TCCR3A) && defined(ICR3) && defined(WGM33)
+	case 3:
+		t->tccra = &TCCR3A;
+		t->tccrb = &TCCR3B;
+		t->icr = &ICR3;
+		t->tcnt = &TCNT3;
+		return true;
+#endif
+#if defined(TCCR4A) && defined(ICR4) && defined(WGM43)
+	case 4:
+		t->tccra = &TCCR4A;
+		t->tccrb = &TCCR4B;
+		t->icr = &ICR4;
+		t->tcnt = &TCNT4;
+		return true;
+#endif
+#if defined(TCCR5A) && defined(ICR5) && defined(WGM53)
+	case 5:
+		t->tccra = &TCCR5A;
+		t->tccrb = &TCCR5B;
+		t->icr = &ICR5;
+		t->tcnt = &TCNT5;
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+// Runs the timer in fast PWM (mode 14) from 0 to top, with clock
+// select cs. The WGM and CS bits are in the same place on all of them.
+static bool timer16_start(uint8_t number, const timer16_t *t, uint8_t cs, uint16_t top)
+{
+	if (timerOwner(number) != TIMER_OWNER_PWM) {
+		if (!timerClaim(number, TIMER_OWNER_PWM))
+			return false;
+		saved_tccra[number] = *t->tccra;
+		saved_tccrb[number] = *t->tccrb;
+	}
+
+	*t->tccrb = 0;
+	*t->tcnt = 0;
+	*t->icr = top;
+	// keep the compare output bits, WGMn1 is bit 1 of TCCRnA
+	*t->tccra = (*t->tccra & ~0x03) | 0x02;
+	// WGMn3 and WGMn2 are bits 4 and 3 of TCCRnB
+	*t->tccrb = 0x18 | cs;
+	return true;
+}
+
+// Sets the PWM frequency of the timer of pin, at the highest resolution
+// it allows. Returns the actual frequency, or 0 if the pin is not on one
+// of these timers, another user has it or hz is out of range (at least
+// 4 steps per period). The duty cycles must be set again afterwards.
+// Returns 0 as well for hz 0, which releases the timer.
+unsigned long analogWriteFrequency(uint8_t pin, unsigned long hz)
+{
+	static const uint16_t prescalers[] = { 1, 8, 64, 256, 1024 };
+	uint8_t timer = digitalPinToTimer(pin);
+	uint8_t number = pwm_timer_number(timer);
+	timer16_t t;
+	unsigned long top;
+	uint8_t cs;
+
+	if (!timer16(timer, &t))
+		return 0;
+
+	if (!hz) {
+		if (timerOwner(number) == TIMER_OWNER_PWM) {
+			*t.tccrb = 0;
+			*t.tccra = saved_tccra[number];
+			*t.tccrb = saved_tccrb[number];
+			timerRelease(number, TIMER_OWNER_PWM);
+		}
+		return 0;
+	}
+
+	for (cs = 0; cs < 5; cs++) {
+		top = F_CPU / prescalers[cs] / hz;
+		if (top <= 65536UL)
+			break;
+	}
+	if (cs == 5 || top < 4)
+		return 0;
+
+	if (!timer16_start(number, &t, cs + 1, top - 1))
+		return 0;
+	return F_CPU / prescalers[cs] / top;
+}
+
+// Sets the duty cycle of pin to value / 65536, rounded down to the
+// resolution of its timer. The timer starts at full 16-bit resolution
+// unless analogWriteFrequency() was called first. Returns false if the
+// pin is not on a 16-bit timer or another user has the timer.
+bool analogWrite16(uint8_t pin, uint16_t value)
+{
+	uint8_t timer = digitalPinToTimer(pin);
+	uint8_t number = pwm_timer_number(timer);
+	timer16_t t;
+	pwm_channel_t ch;
+
+	if (!timer16(timer, &t) || !pwm_channel(timer, &ch))
+		return false;
+	if (timerOwner(number) != TIMER_OWNER_PWM &&
+	    !timer16_start(number, &t, 1, 0xffff))  // no prescaler
+		return false;
+
+	pinMode(pin, OUTPUT);
+	if (value == 0) {
+		digitalWrite(pin, LOW);
+	} else if (value == 0xffff) {
+		digitalWrite(pin, HIGH);
+	} else {
+		*ch.com = (*ch.com & ~ch.comClear) | ch.comSet;
+		*(volatile uint16_t *)ch.ocr = ((uint32_t)value * ((uint32_t)*t.icr + 1)) >> 16;
+	}
+	return true;
+}
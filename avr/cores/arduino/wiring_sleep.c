@@ -0,0 +1,173 @@
+/*
+  wiring_sleep.c - Power-down sleep in delay()
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// This file is only linked in when the sketch calls setDelaySleepMode(),
+// so it only takes the watchdog interrupt from sketches that use it.
+//
+// In the deeper sleep modes timer0 stops, so delay() sleeps for whole
+// watchdog periods (16 ms to 8 s) and moves millis() forward by the time
+// slept afterwards. The watchdog oscillator is off by up to 10%, so its
+// period is measured against timer0 first. Interrupts that wake the CPU
+// earlier are handled, but the CPU goes back to sleep until the watchdog
+// fires, and they see millis() standing still meanwhile.
+//
+// The UARTs stop as well: sleeping waits until the transmit buffers of
+// HardwareSerial are empty, but call Serial.flush() first to make sure
+// the last character is sent too. A sketch that uses the watchdog to
+// reset the board itself never sleeps here.
+
+#include "wiring_private.h"
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+// Time to start the oscillator again after waking up, which the
+// watchdog doesn't measure. 16K clock cycles is the startup time the
+// fuses of most boards with a crystal set.
+#ifndef SLEEP_WAKEUP_CYCLES
+#define SLEEP_WAKEUP_CYCLES 16384
+#endif
+
+#if defined(WDTCSR) && defined(WDIE)
+
+static uint8_t delay_sleep_mode = SLEEP_MODE_IDLE;
+static volatile bool wdt_fired;
+static unsigned long wdt_period;  // measured shortest period in microseconds, 0 until measured
+static unsigned long slept;  // microseconds slept that are not in millis() yet
+
+ISR(WDT_vect)
+{
+	wdt_fired = true;
+}
+
+// Starts the watchdog interrupt (without reset) after 16 ms << prescale
+static void wdt_start(uint8_t prescale)
+{
+	uint8_t oldSREG = SREG;
+
+	cli();
+	wdt_reset();
+	wdt_fired = false;
+	WDTCSR = _BV(WDCE) | _BV(WDE);
+	WDTCSR = _BV(WDIE) | (prescale & 7) | ((prescale & 8) ? _BV(WDP3) : 0);
+	SREG = oldSREG;
+}
+
+static void wdt_stop(void)
+{
+	uint8_t oldSREG = SREG;
+
+	cli();
+	wdt_reset();
+	WDTCSR = _BV(WDCE) | _BV(WDE);
+	WDTCSR = 0;
+	SREG = oldSREG;
+}
+
+static void wdt_calibrate(void)
+{
+	unsigned long start;
+
+	wdt_start(0);
+	start = micros();
+	while (!wdt_fired)
+		;
+	wdt_period = micros() - start;
+	wdt_stop();
+}
+
+static bool serial_busy(void)
+{
+#if defined(UCSR0B)
+	if (bit_is_set(UCSR0B, UDRIE0)) return true;
+#endif
+#if defined(UCSR1B)
+	if (bit_is_set(UCSR1B, UDRIE1)) return true;
+#endif
+#if defined(UCSR2B)
+	if (bit_is_set(UCSR2B, UDRIE2)) return true;
+#endif
+#if defined(UCSR3B)
+	if (bit_is_set(UCSR3B, UDRIE3)) return true;
+#endif
+	return false;
+}
+
+void setDelaySleepMode(uint8_t mode)
+{
+	delay_sleep_mode = mode;
+}
+
+// Called by delay() with ms milliseconds left to wait. Sleeps for the
+// longest watchdog period that fits and returns true, or returns false
+// when it can't sleep now.
+bool delaySleep(unsigned long ms)
+{
+	unsigned long period, wakeup, budget;
+	uint8_t prescale;
+
+	if (delay_sleep_mode == SLEEP_MODE_IDLE || bit_is_clear(SREG, SREG_I) ||
+	    bit_is_set(WDTCSR, WDE) || serial_busy())
+		return false;
+
+	if (!wdt_period)
+		wdt_calibrate();
+
+	// Up to a millisecond of the delay has passed already
+	budget = (ms > 10000 ? 10000 : ms - 1) * 1000;
+	wakeup = clockCyclesToMicroseconds(SLEEP_WAKEUP_CYCLES);
+	if (wdt_period + wakeup > budget)
+		return false;
+	for (prescale = 0; prescale < 9; prescale++)
+		if ((wdt_period << (prescale + 1)) + wakeup > budget)
+			break;
+	period = wdt_period << prescale;
+
+	wdt_start(prescale);
+	set_sleep_mode(delay_sleep_mode);
+	while (!wdt_fired) {
+		// sei() takes effect after the next instruction, so the
+		// watchdog can't fire between checking and sleeping
+		cli();
+		if (!wdt_fired) {
+			sleep_enable();
+			sei();
+			sleep_cpu();
+			sleep_disable();
+		}
+		sei();
+	}
+	wdt_stop();
+
+	slept = timer0_advance(slept + period + wakeup);
+	return true;
+}
+
+#else
+
+void setDelaySleepMode(uint8_t mode)
+{
+}
+
+bool delaySleep(unsigned long ms)
+{
+	return false;
+}
+
+#endif
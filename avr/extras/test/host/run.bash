@@ -0,0 +1,39 @@
+#!/bin/bash -e
+
+#  run.bash - Builds the host tests with the core sources, and runs them.
+#  Copyright (c) 2015 Arduino LLC.  All right reserved.
+#
+#  This library is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU Lesser General Public
+#  License as published by the Free Software Foundation; either
+#  version 2.1 of the License, or (at your option) any later version.
+#
+#  This library is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public
+#  License along with this library; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Needs a host gcc. The core sources get the heap of stub/avr_host.c,
+# so their allocations behave like avr-libc's.
+
+HERE=`cd $(dirname $0) && pwd`
+CORE=$HERE/../../../cores/arduino
+OUT=${OUT:-`mktemp -d`}
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+
+CFLAGS="-O2 -g -I$HERE/stub -include $HERE/stub/avr_host.h"
+CXXFLAGS="$CFLAGS -std=gnu++11"
+HEAP="-include $HERE/stub/avr_heap.h"
+
+$CC $CFLAGS -c $HERE/stub/avr_host.c -o $OUT/avr_host.o
+$CXX $CXXFLAGS $HEAP -I$CORE -c $CORE/WString.cpp -o $OUT/WString.o
+
+for TEST in string_soak string_bench ; do
+  $CXX $CXXFLAGS -I$CORE $HERE/$TEST.cpp $OUT/WString.o $OUT/avr_host.o -o $OUT/$TEST
+  $OUT/$TEST
+done
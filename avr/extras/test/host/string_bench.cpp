@@ -0,0 +1,225 @@
+/*
+  string_bench.cpp - Compares String::replace and indexOf with the old ones
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// Times String::replace() and indexOf() against copies of the versions
+// they replaced, on texts of the size a sketch handles, and fails if the
+// results differ. The old versions searched with strstr(); a byte-wise
+// strstr() like avr-libc's stands in for it, since the host's is much
+// faster than anything an AVR runs. The times are host times, so only
+// the ratios mean something.
+//
+// Usage: string_bench
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "WString.h"
+
+// strstr() as avr-libc does it, one start position at a time
+static char *old_strstr(const char *s, const char *find)
+{
+  for (;; s++) {
+    const char *a = s, *b = find;
+    while (*b && *a == *b) {
+      a++;
+      b++;
+    }
+    if (!*b)
+      return (char *)s;
+    if (!*s)
+      return NULL;
+  }
+}
+
+// The old String internals, enough for replace() and indexOf()
+struct OldString {
+  char *buffer;
+  unsigned int capacity;
+  unsigned int len;
+
+  OldString(const String &s) {
+    len = capacity = s.length();
+    buffer = (char *)avr_malloc(len + 1);
+    memcpy(buffer, s.c_str(), len + 1);
+  }
+  ~OldString() { avr_free(buffer); }
+
+  unsigned char changeBuffer(unsigned int maxStrLen) {
+    char *newbuffer = (char *)avr_realloc(buffer, maxStrLen + 1);
+    if (newbuffer) {
+      buffer = newbuffer;
+      capacity = maxStrLen;
+      return 1;
+    }
+    return 0;
+  }
+
+  int indexOf(const char *s2, unsigned int fromIndex) const {
+    if (fromIndex >= len) return -1;
+    const char *found = old_strstr(buffer + fromIndex, s2);
+    if (found == NULL) return -1;
+    return found - buffer;
+  }
+
+  int lastIndexOf(const char *s2, unsigned int s2len, unsigned int fromIndex) const {
+    if (s2len == 0 || len == 0 || s2len > len) return -1;
+    if (fromIndex >= len) fromIndex = len - 1;
+    int found = -1;
+    for (char *p = buffer; p <= buffer + fromIndex; p++) {
+      p = old_strstr(p, s2);
+      if (!p) break;
+      if ((unsigned int)(p - buffer) <= fromIndex) found = p - buffer;
+    }
+    return found;
+  }
+
+  void replace(const String &findStr, const String &replaceStr) {
+    const char *find = findStr.c_str(), *replace = replaceStr.c_str();
+    unsigned int findLen = findStr.length(), replaceLen = replaceStr.length();
+    if (len == 0 || findLen == 0) return;
+    int diff = replaceLen - findLen;
+    char *readFrom = buffer;
+    char *foundAt;
+    if (diff == 0) {
+      while ((foundAt = old_strstr(readFrom, find)) != NULL) {
+        memcpy(foundAt, replace, replaceLen);
+        readFrom = foundAt + replaceLen;
+      }
+    } else if (diff < 0) {
+      char *writeTo = buffer;
+      while ((foundAt = old_strstr(readFrom, find)) != NULL) {
+        unsigned int n = foundAt - readFrom;
+        memcpy(writeTo, readFrom, n);
+        writeTo += n;
+        memcpy(writeTo, replace, replaceLen);
+        writeTo += replaceLen;
+        readFrom = foundAt + findLen;
+        len += diff;
+      }
+      strcpy(writeTo, readFrom);
+    } else {
+      unsigned int size = len;
+      while ((foundAt = old_strstr(readFrom, find)) != NULL) {
+        readFrom = foundAt + findLen;
+        size += diff;
+      }
+      if (size == len) return;
+      if (size > capacity && !changeBuffer(size)) return;
+      int index = len - 1;
+      while (index >= 0 && (index = lastIndexOf(find, findLen, index)) >= 0) {
+        readFrom = buffer + index + findLen;
+        memmove(readFrom + diff, readFrom, len - (readFrom - buffer));
+        len += diff;
+        buffer[len] = 0;
+        memcpy(buffer + index, replace, replaceLen);
+        index--;
+      }
+    }
+  }
+};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs op until 50 ms have passed, and returns the microseconds per run
+template <typename Op>
+static double time_us(Op op)
+{
+  unsigned long runs = 0;
+  double start = now(), elapsed;
+  do {
+    for (int i = 0; i < 100; i++)
+      op();
+    runs += 100;
+  } while ((elapsed = now() - start) < 0.05);
+  return elapsed * 1e6 / runs;
+}
+
+static int failures;
+
+static void report(const char *name, double oldUs, double newUs, bool same)
+{
+  printf("%-28s old %9.2f us  new %9.2f us  %6.1fx%s\n", name, oldUs, newUs,
+         oldUs / newUs, same ? "" : "  RESULTS DIFFER");
+  if (!same)
+    failures++;
+}
+
+static void bench_replace(const char *name, const String &text,
+                          const String &find, const String &replace)
+{
+  String expected = text;
+  expected.replace(find, replace);
+  OldString check(text);
+  check.replace(find, replace);
+  bool same = expected.length() == check.len && expected == check.buffer;
+
+  double oldUs = time_us([&] { OldString s(text); s.replace(find, replace); });
+  double newUs = time_us([&] { String s = text; s.replace(find, replace); });
+  report(name, oldUs, newUs, same);
+}
+
+static void bench_indexOf(const char *name, const String &text, const String &find)
+{
+  OldString old(text);
+  volatile int sink;
+  bool same = old.indexOf(find.c_str(), 0) == text.indexOf(find);
+  StringFinder finder(find);
+  same = same && text.indexOf(finder) == text.indexOf(find);
+
+  double oldUs = time_us([&] { sink = old.indexOf(find.c_str(), 0); });
+  double newUs = time_us([&] { sink = text.indexOf(find); });
+  report(name, oldUs, newUs, same);
+  newUs = time_us([&] { sink = text.indexOf(finder); });
+  report("  with a StringFinder", oldUs, newUs, same);
+  (void)sink;
+}
+
+int main(void)
+{
+  avr_heap_init(8192);
+
+  String csv;
+  for (int i = 0; csv.length() < 480; i++) {
+    csv += i;
+    csv += ',';
+  }
+  String lines;
+  while (lines.length() < 600)
+    lines += "+CSQ: 17,99\r\nOK\r\n";
+  String modem = lines + "+CGREG: 0,5\r\n";
+  String html;
+  while (html.length() < 600)
+    html += "<td>&lt;value&gt;</td>";
+
+  bench_replace("replace 1 -> 2 chars", csv, ",", ", ");
+  bench_replace("replace 2 -> 1 chars", lines, "\r\n", "\n");
+  bench_replace("replace same length", lines, "OK", "ok");
+  bench_replace("replace 4 -> 1 chars", html, "&lt;", "<");
+  bench_replace("replace 4 -> 6 chars", html, "<td>", "<td a>");
+  bench_indexOf("indexOf 7 chars at the end", modem, "+CGREG:");
+  bench_indexOf("indexOf 9 chars, missing", html, "&amp;nbsp");
+
+  return failures ? 1 : 0;
+}
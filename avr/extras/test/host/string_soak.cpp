@@ -0,0 +1,110 @@
+/*
+  string_soak.cpp - Heap fragmentation soak test for String
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// Builds JSON lines with String += on a 2 KB heap, the size of an Uno's
+// RAM, while a few long-lived Strings change length now and then and
+// pin blocks in the middle of the heap. Fails if an allocation fails, a
+// line comes out wrong, or memory is still allocated at the end.
+//
+// Usage: string_soak [lines]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "WString.h"
+
+static const char *const names[] = {
+  "t", "temp", "humidity", "pressure_hpa", "battery_millivolts_sensor_3"
+};
+
+// A pseudo-random sequence, the same on every run
+static unsigned long next(void)
+{
+  static unsigned long state = 12345;
+  state = state * 1103515245 + 12345;
+  return (state >> 16) & 0x7fff;
+}
+
+static int fail(unsigned long line, const char *what)
+{
+  printf("string_soak: line %lu: %s (heap used %u, largest free %u)\n",
+         line, what, (unsigned)avr_heap_used(),
+         (unsigned)avr_heap_largest_free());
+  return 1;
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long lines = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+  unsigned long allocs;
+  size_t baseline;
+
+  avr_heap_init(2048);
+  baseline = avr_heap_used();
+  {
+    String pinned[4];
+
+    for (unsigned long i = 0; i < lines; i++) {
+      if (i % 97 == 0) {
+        String &s = pinned[next() % 4];
+        unsigned n = next() % 48;
+        s = "";
+        while (s.length() < n)
+          s += (char)('a' + s.length() % 26);
+        if (!s || s.length() != n)
+          return fail(i, "pinned String was not rebuilt");
+      }
+
+      const char *name = names[next() % 5];
+      int value = (int)next() - 16384;
+      float reading = (next() % 4000) / 100.0f + 10;
+
+      String json = "{\"id\":";
+      json += i;
+      json += ",\"";
+      json += name;
+      json += "\":";
+      json += value;
+      json += ",\"raw\":\"";
+      json += String(i * 3, 16);
+      json += "\",\"v\":";
+      json += reading;
+      json += '}';
+
+      char expected[128];
+      snprintf(expected, sizeof(expected),
+               "{\"id\":%lu,\"%s\":%d,\"raw\":\"%lx\",\"v\":%.2f}",
+               i, name, value, i * 3, reading);
+      if (!json)
+        return fail(i, "out of memory");
+      if (json != expected)
+        return fail(i, "line is wrong");
+    }
+  }
+  allocs = avr_heap_allocs();
+  if (avr_heap_failures())
+    return fail(lines, "an allocation failed");
+  if (avr_heap_used() != baseline)
+    return fail(lines, "memory leaked");
+  printf("string_soak: %lu lines, %.2f allocations per line, "
+         "largest free block %u bytes\n",
+         lines, (double)allocs / (lines ? lines : 1),
+         (unsigned)avr_heap_largest_free());
+  return 0;
+}
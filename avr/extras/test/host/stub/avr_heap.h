@@ -0,0 +1,33 @@
+/*
+  avr_heap.h - Moves the allocations of a core source to the avr_host.c
+  heap, for the host tests
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#ifndef AVR_HEAP_H
+#define AVR_HEAP_H
+
+// Declared first, so the defines below do not rename the declarations
+#include <stdlib.h>
+#include "avr_host.h"
+
+#define malloc avr_malloc
+#define realloc avr_realloc
+#define free avr_free
+
+#endif
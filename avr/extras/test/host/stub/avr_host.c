@@ -0,0 +1,219 @@
+/*
+  avr_host.c - avr-libc functions the host lacks, for the host tests
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "avr_host.h"
+
+char *ultoa(unsigned long value, char *buf, int radix)
+{
+	char tmp[8 * sizeof(value) + 1];
+	char *p = tmp;
+	char *out = buf;
+
+	do {
+		int d = value % radix;
+		*p++ = d < 10 ? '0' + d : 'a' + d - 10;
+		value /= radix;
+	} while (value);
+	while (p > tmp)
+		*out++ = *--p;
+	*out = 0;
+	return buf;
+}
+
+char *ltoa(long value, char *buf, int radix)
+{
+	// Like avr-libc, only base 10 has a sign
+	if (radix == 10 && value < 0) {
+		buf[0] = '-';
+		ultoa(-(unsigned long)value, buf + 1, radix);
+		return buf;
+	}
+	return ultoa((unsigned long)value, buf, radix);
+}
+
+char *utoa(unsigned int value, char *buf, int radix)
+{
+	return ultoa(value, buf, radix);
+}
+
+char *itoa(int value, char *buf, int radix)
+{
+	if (radix == 10)
+		return ltoa(value, buf, radix);
+	return ultoa((unsigned int)value, buf, radix);
+}
+
+char *dtostrf(double value, signed char width, unsigned char prec, char *buf)
+{
+	sprintf(buf, "%*.*f", width, prec, value);
+	return buf;
+}
+
+// The heap is a sequence of blocks, each starting with a 2-byte header
+// that holds the size of the block (without the header) times two, plus
+// one when it is in use. Free blocks next to each other are merged when
+// they are walked.
+
+#define HEAP_MAX 65536
+#define HEADER 2
+
+static uint8_t heap[HEAP_MAX];
+static size_t heap_size;
+static unsigned long allocs, failures;
+
+static size_t block_size(size_t at)
+{
+	return (heap[at] | heap[at + 1] << 8) >> 1;
+}
+
+static int block_used(size_t at)
+{
+	return heap[at] & 1;
+}
+
+static void set_block(size_t at, size_t size, int used)
+{
+	size_t word = size << 1 | used;
+	heap[at] = word;
+	heap[at + 1] = word >> 8;
+}
+
+// Merges the free blocks after the one at at into it
+static void merge(size_t at)
+{
+	size_t size = block_size(at);
+	size_t next;
+
+	while ((next = at + HEADER + size) < heap_size && !block_used(next))
+		size += HEADER + block_size(next);
+	set_block(at, size, block_used(at));
+}
+
+// Makes the block at at size bytes long, if it is larger by enough to
+// split off a free block
+static void split(size_t at, size_t size)
+{
+	size_t rest = block_size(at) - size;
+
+	if (rest < HEADER + 2)
+		return;
+	set_block(at, size, block_used(at));
+	set_block(at + HEADER + size, rest - HEADER, 0);
+}
+
+void avr_heap_init(size_t size)
+{
+	heap_size = size < HEAP_MAX ? size : HEAP_MAX;
+	set_block(0, heap_size - HEADER, 0);
+	allocs = failures = 0;
+}
+
+void *avr_malloc(size_t size)
+{
+	size_t at;
+
+	if (!heap_size)
+		avr_heap_init(2048);
+	if (size < 2)
+		size = 2;
+	for (at = 0; at < heap_size; at += HEADER + block_size(at)) {
+		if (block_used(at))
+			continue;
+		merge(at);
+		if (block_size(at) >= size) {
+			split(at, size);
+			set_block(at, block_size(at), 1);
+			allocs++;
+			return heap + at + HEADER;
+		}
+	}
+	failures++;
+	return NULL;
+}
+
+void avr_free(void *ptr)
+{
+	size_t at;
+
+	if (!ptr)
+		return;
+	at = (uint8_t *)ptr - heap - HEADER;
+	set_block(at, block_size(at), 0);
+}
+
+void *avr_realloc(void *ptr, size_t size)
+{
+	size_t at, old;
+	void *moved;
+
+	if (!ptr)
+		return avr_malloc(size);
+	at = (uint8_t *)ptr - heap - HEADER;
+	old = block_size(at);
+	// Grow in place into free blocks that follow, if there are enough
+	merge(at);
+	if (block_size(at) >= size) {
+		split(at, size < 2 ? 2 : size);
+		return ptr;
+	}
+	moved = avr_malloc(size);
+	if (!moved)
+		return NULL;
+	memcpy(moved, ptr, old);
+	avr_free(ptr);
+	return moved;
+}
+
+size_t avr_heap_used(void)
+{
+	size_t at, used = 0;
+
+	for (at = 0; at < heap_size; at += HEADER + block_size(at))
+		if (block_used(at))
+			used += block_size(at);
+	return used;
+}
+
+size_t avr_heap_largest_free(void)
+{
+	size_t at, largest = 0;
+
+	for (at = 0; at < heap_size; at += HEADER + block_size(at)) {
+		if (block_used(at))
+			continue;
+		merge(at);
+		if (block_size(at) > largest)
+			largest = block_size(at);
+	}
+	return largest;
+}
+
+unsigned long avr_heap_allocs(void)
+{
+	return allocs;
+}
+
+unsigned long avr_heap_failures(void)
+{
+	return failures;
+}
@@ -0,0 +1,57 @@
+/*
+  avr_host.h - avr-libc functions the host lacks, for the host tests
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#ifndef AVR_HOST_H
+#define AVR_HOST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+char *itoa(int value, char *buf, int radix);
+char *utoa(unsigned int value, char *buf, int radix);
+char *ltoa(long value, char *buf, int radix);
+char *ultoa(unsigned long value, char *buf, int radix);
+char *dtostrf(double value, signed char width, unsigned char prec, char *buf);
+
+// A heap of a fixed size, allocated first fit with 2 bytes of overhead
+// per block like avr-libc's malloc(), so the tests see the same
+// fragmentation. The core sources are built with stub/avr_heap.h, which
+// defines malloc, realloc and free to these.
+void avr_heap_init(size_t size);
+void *avr_malloc(size_t size);
+void *avr_realloc(void *ptr, size_t size);
+void avr_free(void *ptr);
+
+// Bytes in allocated blocks, the largest block that can be allocated,
+// and the number of allocations (including ones by realloc()) and of
+// failed allocations since avr_heap_init()
+size_t avr_heap_used(void);
+size_t avr_heap_largest_free(void);
+unsigned long avr_heap_allocs(void);
+unsigned long avr_heap_failures(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
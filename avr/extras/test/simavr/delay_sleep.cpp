@@ -0,0 +1,82 @@
+/*
+  delay_sleep.cpp - Firmware for the idle sleep timing test
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// Runs with setIdleMode(IDLE_SLEEP). PB5 is high during each delay()
+// below, PB4 toggles from a task every 10 ms and PB3 from a coroutine
+// every 5 ms. delay_sleep_test.c checks the timing of the edges and how
+// long the CPU slept.
+
+#include <Arduino.h>
+#include <avr/sleep.h>
+
+static SchedulerTask task;
+static Coroutine co;
+static uint8_t coStack[192];
+
+static void toggleTask(void)
+{
+  PORTB ^= _BV(PB4);
+}
+
+static void toggleCoroutine(void)
+{
+  for (;;) {
+    PORTB ^= _BV(PB3);
+    delay(5);
+  }
+}
+
+static void pulse(unsigned long ms)
+{
+  PORTB |= _BV(PB5);
+  delay(ms);
+  PORTB &= ~_BV(PB5);
+  delay(10);
+}
+
+void setup()
+{
+  DDRB = _BV(PB5) | _BV(PB4) | _BV(PB3);
+  setIdleMode(IDLE_SLEEP);
+
+  // delay() alone
+  pulse(100);
+  pulse(250);
+  pulse(1000);
+
+  // with a task that is due during the delay
+  scheduleTask(&task, toggleTask, 10000, 10000);
+  pulse(200);
+  cancelTask(&task);
+
+  // with a coroutine that waits in delay() as well
+  startCoroutine(&co, toggleCoroutine, coStack, sizeof(coStack));
+  pulse(200);
+
+  // Sleeping with interrupts off ends the simulation
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  cli();
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop()
+{
+}
@@ -0,0 +1,158 @@
+/*
+  delay_sleep_test.c - Checks delay() timing with idle sleep in simavr
+  Part of Arduino - http://www.arduino.cc/
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+// Runs delay_sleep.elf (built from delay_sleep.cpp) and checks that:
+// - each delay(ms) takes ms milliseconds, to within the resolution of
+//   micros() at the short end and DELAY_SLACK_US at the long end
+// - the task and the coroutine run every 10 and 5 ms, to within
+//   PERIOD_SLACK_US, while the sketch sleeps in delay()
+// - the CPU sleeps for at least MIN_SLEEP_PERCENT of each delay()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+
+#define F_CPU 16000000UL
+#define US(cycles) ((long)((cycles) / (F_CPU / 1000000)))
+
+#define DELAY_SLACK_US 100
+#define PERIOD_SLACK_US 100
+#define MIN_SLEEP_PERCENT 75
+#define MAX_EDGES 256
+
+static const long pulses_ms[] = { 100, 250, 1000, 200, 200 };
+#define PULSES (sizeof(pulses_ms) / sizeof(pulses_ms[0]))
+
+typedef struct {
+	int bit;
+	uint32_t value;
+	int count;
+	avr_cycle_count_t cycle[MAX_EDGES];
+	avr_cycle_count_t slept[MAX_EDGES];  // sleeping cycles before the edge
+} pin_t;
+
+static avr_t *avr;
+static avr_cycle_count_t slept;
+static pin_t pins[] = { { 5 }, { 4 }, { 3 } };
+static int failures;
+
+static void pin_changed(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	pin_t *pin = param;
+
+	if (value == pin->value || pin->count == MAX_EDGES)
+		return;
+	pin->value = value;
+	pin->cycle[pin->count] = avr->cycle;
+	pin->slept[pin->count] = slept;
+	pin->count++;
+}
+
+static void check(int ok, const char *what)
+{
+	printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok)
+		failures++;
+}
+
+// Checks that the edges of pin from first to last are period_us apart
+static void check_period(pin_t *pin, const char *name, long period_us)
+{
+	long worst = 0;
+	char what[80];
+	int i;
+
+	if (pin->count < 4) {
+		snprintf(what, sizeof(what), "%s: %d edges", name, pin->count);
+		check(0, what);
+		return;
+	}
+	// The first edge comes after starting, not after a period
+	for (i = 2; i < pin->count; i++) {
+		long d = US(pin->cycle[i] - pin->cycle[i - 1]) - period_us;
+		if (labs(d) > labs(worst))
+			worst = d;
+	}
+	snprintf(what, sizeof(what), "%s: worst %ld us, expected %ld us", name, period_us + worst, period_us);
+	check(labs(worst) <= PERIOD_SLACK_US, what);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "delay_sleep.elf";
+	elf_firmware_t firmware = {{0}};
+	unsigned int i;
+	int state;
+
+	if (elf_read_firmware(path, &firmware)) {
+		fprintf(stderr, "can't read %s\n", path);
+		return 2;
+	}
+	avr = avr_make_mcu_by_name("atmega328p");
+	if (!avr)
+		return 2;
+	avr_init(avr);
+	avr->frequency = F_CPU;
+	avr_load_firmware(avr, &firmware);
+
+	for (i = 0; i < sizeof(pins) / sizeof(pins[0]); i++)
+		avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), pins[i].bit),
+		                        pin_changed, &pins[i]);
+
+	do {
+		avr_cycle_count_t before = avr->cycle;
+		int sleeping = avr->state == cpu_Sleeping;
+		state = avr_run(avr);
+		if (sleeping)
+			slept += avr->cycle - before;
+	} while (state != cpu_Done && state != cpu_Crashed && avr->cycle < 10 * F_CPU);
+
+	if (state != cpu_Done) {
+		printf("FAIL firmware did not finish\n");
+		return 1;
+	}
+	if (pins[0].count != 2 * PULSES) {
+		printf("FAIL %d edges on PB5, expected %d\n", pins[0].count, (int)(2 * PULSES));
+		return 1;
+	}
+
+	for (i = 0; i < PULSES; i++) {
+		avr_cycle_count_t cycles = pins[0].cycle[2 * i + 1] - pins[0].cycle[2 * i];
+		avr_cycle_count_t asleep = pins[0].slept[2 * i + 1] - pins[0].slept[2 * i];
+		long expected = pulses_ms[i] * 1000;
+		long got = US(cycles);
+		char what[80];
+
+		snprintf(what, sizeof(what), "delay(%ld) #%u: %ld us", pulses_ms[i], i + 1, got);
+		// micros() counts in steps of 4 us, which delay() may be short by
+		check(got >= expected - 4 && got <= expected + DELAY_SLACK_US, what);
+		snprintf(what, sizeof(what), "delay(%ld) #%u: asleep %d%% of the time",
+		         pulses_ms[i], i + 1, (int)(asleep * 100 / cycles));
+		check(asleep * 100 >= cycles * MIN_SLEEP_PERCENT, what);
+	}
+
+	check_period(&pins[1], "task period", 10000);
+	check_period(&pins[2], "coroutine period", 5000);
+
+	printf("%d failure(s)\n", failures);
+	return failures != 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/bash -e
+
+#  run.bash - Builds the core and the test firmware, and runs it in simavr.
+#  Copyright (c) 2015 Arduino LLC.  All right reserved.
+#
+#  This library is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU Lesser General Public
+#  License as published by the Free Software Foundation; either
+#  version 2.1 of the License, or (at your option) any later version.
+#
+#  This library is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+#  Lesser General Public License for more details.
+#
+#  You should have received a copy of the GNU Lesser General Public
+#  License along with this library; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+# Needs avr-gcc and simavr (headers and libsimavr). Set SIMAVR_CFLAGS and
+# SIMAVR_LIBS if they are not in the default places.
+
+HERE=`cd $(dirname $0) && pwd`
+CORE=$HERE/../../../cores/arduino
+VARIANT=$HERE/../../../variants/standard
+OUT=${OUT:-`mktemp -d`}
+SIMAVR_CFLAGS=${SIMAVR_CFLAGS:-"-I/usr/include/simavr -I/usr/local/include/simavr"}
+SIMAVR_LIBS=${SIMAVR_LIBS:-"-lsimavr -lelf"}
+
+# The flags of platform.txt, for an Uno
+FLAGS="-mmcu=atmega328p -DF_CPU=16000000L -DARDUINO=10819 -DARDUINO_AVR_UNO -DARDUINO_ARCH_AVR -Os -g -ffunction-sections -fdata-sections -flto -I$CORE -I$VARIANT"
+CFLAGS="$FLAGS -std=gnu11 -fno-fat-lto-objects"
+CXXFLAGS="$FLAGS -std=gnu++11 -fpermissive -fno-exceptions -fno-threadsafe-statics -Wno-error=narrowing"
+
+mkdir -p $OUT/core
+rm -f $OUT/core.a
+for f in $CORE/*.c $CORE/*.cpp $CORE/*.S; do
+  o=$OUT/core/`basename $f`.o
+  case $f in
+    *.c) avr-gcc $CFLAGS -c $f -o $o ;;
+    *.cpp) avr-g++ $CXXFLAGS -c $f -o $o ;;
+    *.S) avr-gcc $FLAGS -x assembler-with-cpp -c $f -o $o ;;
+  esac
+  avr-gcc-ar rcs $OUT/core.a $o
+done
+
+avr-g++ $CXXFLAGS -c $HERE/delay_sleep.cpp -o $OUT/delay_sleep.cpp.o
+avr-gcc $FLAGS -fuse-linker-plugin -Wl,--gc-sections -o $OUT/delay_sleep.elf $OUT/delay_sleep.cpp.o $OUT/core.a -lm
+
+cc -O2 $SIMAVR_CFLAGS -o $OUT/delay_sleep_test $HERE/delay_sleep_test.c $SIMAVR_LIBS
+$OUT/delay_sleep_test $OUT/delay_sleep.elf
@@ -404,6 +404,24 @@ int SoftwareSerial::read()
   return d;
 }
 
+int SoftwareSerial::read(uint8_t *buffer, size_t size)
+{
+  if (!isListening())
+    return 0;
+
+  // Copy from "head" up to the tail as it was on entry. Bytes received
+  // meanwhile are left for the next call.
+  uint8_t head = _receive_buffer_head;
+  uint8_t tail = _receive_buffer_tail;
+  size_t count = 0;
+  while (count < size && head != tail) {
+    buffer[count++] = _receive_buffer[head];
+    head = (head + 1) % _SS_MAX_RX_BUFF;
+  }
+  _receive_buffer_head = head;
+  return count;
+}
+
 int SoftwareSerial::available()
 {
   if (!isListening())
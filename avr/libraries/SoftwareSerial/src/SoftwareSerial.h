@@ -101,6 +101,7 @@ public:
 
   virtual size_t write(uint8_t byte);
   virtual int read();
+  virtual int read(uint8_t *buffer, size_t size);
   virtual int available();
   virtual void flush();
   operator bool() { return true; }
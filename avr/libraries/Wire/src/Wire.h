@@ -71,6 +71,7 @@ class TwoWire : public Stream
     virtual size_t write(const uint8_t *, size_t);
     virtual int available(void);
     virtual int read(void);
+    virtual int read(uint8_t *, size_t);
     virtual int peek(void);
     virtual void flush(void);
     void onReceive( void (*)(int) );